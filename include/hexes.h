@@ -32,6 +32,8 @@ typedef enum HexAttributes {
 int HexWidth();
 int HexHeight();
 int HexUnicode();
+unsigned int HexSkippedFrames();
+const char *HexCPULevel();
 
 /* Buffers. */
 #define	UTF8_MAX_BYTES	4
@@ -40,6 +42,13 @@ typedef struct HexChar {
 	unsigned int FG, BG, Attr;
 } HexChar;
 
+/* Wide characters take up two cells, with the one on the right holding this. Either half on its own is shown as a space. */
+#define	HEX_WIDE_TAIL	"\xFF"
+
+/* Grapheme clusters too long for a cell, such as a character with combining marks or an emoji sequence, are kept in a
+   pool with the cell holding a handle starting with this. HexGetCharBytes() gives what's to be shown for any cell. */
+#define	HEX_CLUSTER	"\xFE"
+
 /* The following does nothing at present, but could be useful if we extend HexChar. */
 #define HEX_SET_CHAR(CP, FG, BG, Attr) { CP, FG, BG, Attr }
 
@@ -50,19 +59,35 @@ typedef struct HexBuffer {
 	unsigned int FG, BG;	/* Colors. */
 	unsigned int Attr;
 	unsigned char TabStop;
-	HexChar *Data;
+	HexChar *Data;		/* Only set for HEX_LAYOUT_CHARS. */
+	unsigned char Layout;
 } HexBuffer;
 
+/* How a buffer's cells are kept. HEX_LAYOUT_PLANES buffers have no Data, so can only be reached through the functions.
+   The terminal buffer & those from HexNewBuffer() are always HEX_LAYOUT_CHARS. */
+typedef enum HexLayouts {
+	HEX_LAYOUT_CHARS,
+	HEX_LAYOUT_PLANES	/* Each field kept apart, so blits & fills of only some are done a field at a time. */
+} HexLayouts;
+
 HexBuffer *HexNewBuffer(int W, int H);
+HexBuffer *HexNewBufferLayout(int W, int H, int Layout);
 HexBuffer *HexResizeBuffer(HexBuffer *Original, int W, int H);
 void HexFreeBuffer(HexBuffer *Buffer);
 const HexChar *HexGetHexChar(HexBuffer *D, int X, int Y);
+void HexReadHexChar(const HexBuffer *D, int X, int Y, HexChar *Out);
+const char *HexGetCharBytes(const HexChar *Char, size_t *Size);
 
 typedef enum HexFlags {
 	HEX_FLAG_DISPLAY_NO_CURSOR = 1,
 	HEX_FLAG_DISPLAY_REVERSE_VIDEO = 2,
 	HEX_FLAG_DISPLAY_BRIGHT_CURSOR = 4,
-	HEX_FLAG_EVENT_FOCUS = 8
+	HEX_FLAG_EVENT_FOCUS = 8,
+	HEX_FLAG_OUTPUT_SYNC = 16,	/* Force synchronized output on or off. Otherwise used if detected. */
+	HEX_FLAG_OUTPUT_NO_SYNC = 32,
+	HEX_FLAG_OUTPUT_SKIP_FRAMES = 64,	/* HexFlush() won't wait on the terminal, skipping frames while it's behind. */
+	HEX_FLAG_OUTPUT_ADAPTIVE_COLOR = 128,	/* Send colors at a lower depth while the terminal is lagging. */
+	HEX_FLAG_OUTPUT_PARALLEL = 256	/* Large changes are drawn in bands across several threads. */
 } HexFlags;
 
 int HexChangeFlags(int *Flags);
@@ -105,7 +130,8 @@ typedef enum HexDrawFlags {
 	HEX_DRAW_FG = 2,
 	HEX_DRAW_BG = 4,
 	HEX_DRAW_ATTR = 8,
-	HEX_DRAW_TRANSPARENT = 16
+	HEX_DRAW_TRANSPARENT = 16,
+	HEX_DRAW_DITHER = 32	/* Dither colors the terminal can't display, rather than picking the nearest. */
 } HexDrawFlags;
 
 void HexBlitRaw(const HexBuffer *S, HexBuffer *D, int SX, int SY, int DW, int DY, int W, int H, unsigned int Flags);
@@ -117,8 +143,16 @@ void HexPutHexChar(HexBuffer *D, int X, int Y, const HexChar *Char);
 
 /* Flushing. */
 int HexFlush(int CurX, int CurY);
+int HexFlushBudget(size_t Budget, int CurX, int CurY);
+int HexAddPriority(int X, int Y, int W, int H);
+void HexClearPriorities();
 int HexFullFlush(int UseBuffer, int CurX, int CurY);
 
+/* Flushes on another thread from a copy of what's changed, so drawing can carry on. */
+int HexFlushAsync(int CurX, int CurY);
+int HexFlushPending();
+int HexFlushWait();
+
 /* Input. We try to copy curses codes where possible, for ease of porting. */
 typedef enum HexChars {
 	HEX_CHAR_ERROR = -1,
@@ -13,20 +13,137 @@
 #include "hexes.h"
 
 #define GetOffset(X, Y, W) ((Y) * (W) + (X))
+#define	DRAW_ALL	(HEX_DRAW_CP | HEX_DRAW_FG | HEX_DRAW_BG | HEX_DRAW_ATTR)
 
-extern HexBuffer *Buffer;
-extern char *Damage;
-extern int HasDamage;
+extern HexBuffer *Terminal;
 
 int GetU8Size(const char *Char);
+void RecordCopy(int SX, int SY, int X, int Y, int W, int H, unsigned int Flags);
+int UpdateBufferCell(unsigned int Offset, const HexChar *Old);
+void MarkBufferDamage(int X, int Y, int W, int H);
+int GetTerminalColors();
+unsigned int DitherColor(unsigned int Color, int Colors, int X, int Y);
+
+/* HEX_LAYOUT_PLANES. Each field has a plane of its own, one after the other, in the order of their draw flags. */
+enum Planes {
+	PLANE_CP,
+	PLANE_FG,
+	PLANE_BG,
+	PLANE_ATTR,
+	PLANES
+};
+
+static unsigned int *GetPlane(const HexBuffer *B, int Plane)
+{
+	return (unsigned int *)&B[1] + (size_t)Plane * B->W * B->H;
+}
 
-/* We place the buffer at the end of the allocated memory. */
-HexBuffer *HexNewBuffer(int W, int H)
+static size_t GetLayoutCellSize(int Layout)
 {
-	size_t Size;
+	switch (Layout) {
+		case HEX_LAYOUT_CHARS:
+			return sizeof(HexChar);
+		case HEX_LAYOUT_PLANES:
+			return PLANES * sizeof(unsigned int);
+	}
+
+	return 0;
+}
+
+/* Cells of planar buffers are worked on as a HexChar, read & written back with these. */
+void ReadCell(const HexBuffer *B, unsigned int Offset, HexChar *C)
+{
+	memcpy(C->CP, &GetPlane(B, PLANE_CP)[Offset], UTF8_MAX_BYTES);
+	C->FG = GetPlane(B, PLANE_FG)[Offset];
+	C->BG = GetPlane(B, PLANE_BG)[Offset];
+	C->Attr = GetPlane(B, PLANE_ATTR)[Offset];
+
+	return;
+}
+
+void WriteCell(HexBuffer *B, unsigned int Offset, const HexChar *C)
+{
+	memcpy(&GetPlane(B, PLANE_CP)[Offset], C->CP, UTF8_MAX_BYTES);
+	GetPlane(B, PLANE_FG)[Offset] = C->FG;
+	GetPlane(B, PLANE_BG)[Offset] = C->BG;
+	GetPlane(B, PLANE_ATTR)[Offset] = C->Attr;
+
+	return;
+}
+
+/* Sets each of the flagged planes across the area, a row at a time or all at once if it spans the width. */
+static void FillPlanes(HexBuffer *D, unsigned int Offset, int W, int H, const HexChar *C, unsigned int Flags)
+{
+	unsigned int Values[PLANES], *Plane;
+	int P, Y, I;
+
+	memcpy(&Values[PLANE_CP], C->CP, UTF8_MAX_BYTES);
+	Values[PLANE_FG] = C->FG;
+	Values[PLANE_BG] = C->BG;
+	Values[PLANE_ATTR] = C->Attr;
+
+	if (W == D->W) {
+		W *= H;
+		H = 1;
+	}
+
+	for (P = 0; P < PLANES; P++) {
+		if (!(Flags & 1 << P))
+			continue;
+
+		Plane = &GetPlane(D, P)[Offset];
+		for (Y = 0; Y < H; Y++, Plane += D->W) {
+			for (I = 0; I < W; I++)
+				Plane[I] = Values[P];
+		}
+	}
+
+	return;
+}
+
+/* Fills an area of an offscreen buffer without going cell by cell, when it can. Whole cells can be set in any layout,
+   while planes can be set on their own. The character is cut down to its first, as it would be drawn on its own.
+   Returns 0 if it was left to the caller. */
+int FillArea(HexBuffer *D, int DX, int DY, int W, int H, const HexChar *Char, unsigned int Flags)
+{
+	HexChar C = *Char;
+	unsigned int Offset;
+	int Size, Y, I;
+
+	if (D == Terminal || (D->Layout != HEX_LAYOUT_PLANES && (Flags & DRAW_ALL) != DRAW_ALL))
+		return 0;
+
+	Size = GetU8Size(C.CP);
+	if (Size < UTF8_MAX_BYTES)
+		memset(&C.CP[Size], 0, UTF8_MAX_BYTES - Size);
+
+	Offset = GetOffset(DX, DY, D->W);
+	switch (D->Layout) {
+		case HEX_LAYOUT_CHARS:
+			for (Y = 0; Y < H; Y++, Offset += D->W) {
+				for (I = 0; I < W; I++)
+					D->Data[Offset + I] = C;
+			}
+			break;
+		case HEX_LAYOUT_PLANES:
+			FillPlanes(D, Offset, W, H, &C, Flags);
+			break;
+	}
+
+	return 1;
+}
+
+/* We place the buffer at the end of the allocated memory. Only HEX_LAYOUT_CHARS buffers have their Data set, the others
+   being reached through the functions. */
+HexBuffer *HexNewBufferLayout(int W, int H, int Layout)
+{
+	size_t Size, CellSize;
 	HexBuffer *B;
 
-	Size = sizeof(HexBuffer) + ((W * H) * sizeof(HexChar));
+	CellSize = GetLayoutCellSize(Layout);
+	if (!CellSize)
+		return NULL;
+	Size = sizeof(HexBuffer) + ((W * H) * CellSize);
 
 	B = calloc(Size, 1);
 	if (!B)
@@ -35,30 +152,102 @@ HexBuffer *HexNewBuffer(int W, int H)
 	B->W = W;
 	B->H = H;
 	B->TabStop = HEX_DEFAULT_TAB_STOP;
-	B->Data = (HexChar *)&B[1];
+	B->Layout = Layout;
+	if (Layout == HEX_LAYOUT_CHARS)
+		B->Data = (HexChar *)&B[1];
 
 	return B;
 }
 
+HexBuffer *HexNewBuffer(int W, int H)
+{
+	return HexNewBufferLayout(W, H, HEX_LAYOUT_CHARS);
+}
+
+/* Copies between offscreen buffers of the same layout without going cell by cell. Whole cells are copied a row at a
+   time, while planes can be copied on their own. The terminal buffer is left to the cell by cell path, as it tracks what
+   changes. Returns 0 if it was left to the caller. */
+static int CopyArea(const HexBuffer *S, HexBuffer *D, unsigned int SOffset, unsigned int DOffset, int W, int H, unsigned int Flags)
+{
+	size_t Size;
+	unsigned int Planes, P;
+	int Y;
+
+	if (S == D || D == Terminal || S->Layout != D->Layout || Flags & (HEX_DRAW_TRANSPARENT | HEX_DRAW_DITHER))
+		return 0;
+
+	/* Cells are then treated as a single plane. */
+	if (D->Layout == HEX_LAYOUT_PLANES) {
+		Planes = PLANES;
+		Size = sizeof(unsigned int);
+	} else if ((Flags & DRAW_ALL) == DRAW_ALL) {
+		Planes = 1;
+		Size = GetLayoutCellSize(D->Layout);
+	} else
+		return 0;
+
+	if (W == S->W && W == D->W) {
+		W *= H;
+		H = 1;
+	}
+
+	for (P = 0; P < Planes; P++) {
+		const char *SP = (const char *)&S[1] + (P * S->W * S->H + SOffset) * Size;
+		char *DP = (char *)&D[1] + (P * D->W * D->H + DOffset) * Size;
+
+		if (Planes > 1 && !(Flags & 1 << P))
+			continue;
+
+		for (Y = 0; Y < H; Y++) {
+			memcpy(DP, SP, W * Size);
+			SP += S->W * Size;
+			DP += D->W * Size;
+		}
+	}
+
+	return 1;
+}
+
 /* Do the actual drawing. May be called directly if the bounds are safe. */
 void HexBlitRaw(const HexBuffer *S, HexBuffer *D, int SX, int SY, int DX, int DY, int W, int H, unsigned int Flags)
 {
-	int Y;
+	int Y, Colors = 0, IsBuffer;
 	unsigned int SOffset, DOffset;
 
-	HexChar *SD = S->Data, *DD = D->Data, *SC, *DC;
+	HexChar *SD = S->Data, *DD = D->Data, *DC, Old, SCell, DCell;
+	const HexChar *SC;
 	SOffset = GetOffset(SX, SY, S->W);
 	DOffset = GetOffset(DX, DY, D->W);
 
 	if (!Flags)
-		Flags = ~HEX_DRAW_TRANSPARENT;
+		Flags = ~(HEX_DRAW_TRANSPARENT | HEX_DRAW_DITHER);
+	if (Flags & HEX_DRAW_DITHER)
+		Colors = GetTerminalColors();
+
+	if (CopyArea(S, D, SOffset, DOffset, W, H, Flags))
+		return;
+
+	IsBuffer = D == Terminal;
+	if (S == Terminal && IsBuffer)
+		RecordCopy(SX, SY, DX, DY, W, H, Flags);
 
 	for (Y = 0; Y < H; Y++) {
-		int X;
+		int X, From = W, To = 0;
 
 		for (X = 0; X < W; X++) {
-			SC = &SD[SOffset + X];
-			DC = &DD[DOffset + X];
+			if (SD)
+				SC = &SD[SOffset + X];
+			else {
+				ReadCell(S, SOffset + X, &SCell);
+				SC = &SCell;
+			}
+			if (DD)
+				DC = &DD[DOffset + X];
+			else {
+				ReadCell(D, DOffset + X, &DCell);
+				DC = &DCell;
+			}
+			Old = *DC;
 
 			if (Flags & HEX_DRAW_CP) {
 				size_t Size;
@@ -71,30 +260,56 @@ void HexBlitRaw(const HexBuffer *S, HexBuffer *D, int SX, int SY, int DX, int DY
 					DC->CP[Size] = '\0';
 			}
 			if (Flags & HEX_DRAW_FG)
-				DC->FG = SC->FG;
+				DC->FG = Colors ? DitherColor(SC->FG, Colors, DX + X, DY + Y) : SC->FG;
 			if (Flags & HEX_DRAW_BG)
-				DC->BG = SC->BG;
+				DC->BG = Colors ? DitherColor(SC->BG, Colors, DX + X, DY + Y) : SC->BG;
 			if (Flags & HEX_DRAW_ATTR)
 				DC->Attr = SC->Attr;
 
-			if (D == Buffer)
-				HasDamage = Damage[DOffset + X] = 1;
+			if (!DD)
+				WriteCell(D, DOffset + X, DC);
+			else if (IsBuffer && UpdateBufferCell(DOffset + X, &Old)) {
+				if (From > X)
+					From = X;
+				To = X + 1;
+			}
 		}
 
 		SOffset += S->W;
 		DOffset += D->W;
+
+		if (From < To)
+			MarkBufferDamage(DX + From, DY + Y, To - From, 1);
 	}
 
 	return;
 }
 
-const HexChar *HexGetHexChar(HexBuffer *D, int X, int Y)
+/* Copies the cell out, so works the same whatever the layout. */
+void HexReadHexChar(const HexBuffer *D, int X, int Y, HexChar *Out)
 {
 	unsigned int DOffset;
 
 	DOffset = GetOffset(X, Y, D->W);
+	if (D->Data)
+		*Out = D->Data[DOffset];
+	else
+		ReadCell(D, DOffset, Out);
+
+	return;
+}
+
+/* For planar buffers, the cell's gathered into space kept for each thread. So what's returned is only valid until the
+   next call from the same thread; use HexReadHexChar() to keep it longer. */
+const HexChar *HexGetHexChar(HexBuffer *D, int X, int Y)
+{
+	static _Thread_local HexChar Gathered;
+
+	if (D->Data)
+		return &D->Data[GetOffset(X, Y, D->W)];
 
-	return &D->Data[DOffset];
+	HexReadHexChar(D, X, Y, &Gathered);
+	return &Gathered;
 }
 
 void HexBlit(const HexBuffer *S, HexBuffer *D, int SX, int SY, int DX, int DY, int W, int H, unsigned int Flags)
@@ -150,10 +365,11 @@ HexBuffer *HexResizeBuffer(HexBuffer *Original, int W, int H)
 	OldW = Original->W;
 	OldH = Original->H;
 
-	OldSize = sizeof(HexBuffer) + ((OldW * OldH) * sizeof(HexChar));
-	Size = sizeof(HexBuffer) + ((W * H) * sizeof(HexChar));
+	OldSize = sizeof(HexBuffer) + ((OldW * OldH) * GetLayoutCellSize(Original->Layout));
+	Size = sizeof(HexBuffer) + ((W * H) * GetLayoutCellSize(Original->Layout));
 
-	if (OldW == W) {
+	/* The planes would each need moving. */
+	if (OldW == W && Original->Layout != HEX_LAYOUT_PLANES) {
 		New = realloc(Original, Size);
 		if (!New)
 			return NULL;
@@ -165,13 +381,14 @@ HexBuffer *HexResizeBuffer(HexBuffer *Original, int W, int H)
 
 		New->W = W;
 		New->H = H;
-		New->Data = (HexChar *)&New[1];
+		if (New->Data)
+			New->Data = (HexChar *)&New[1];
 	} else {
-		New = HexNewBuffer(W, H);
+		New = HexNewBufferLayout(W, H, Original->Layout);
 		if (!New)
 			return NULL;
 
-		HexBlitRaw(Original, New, 0, 0, 0, 0, OldW < W ? OldW : W, OldH < H ? OldH : H, ~0);
+		HexBlitRaw(Original, New, 0, 0, 0, 0, OldW < W ? OldW : W, OldH < H ? OldH : H, DRAW_ALL);
 
 		New->X = Original->X;
 		New->Y = Original->Y;
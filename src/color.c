@@ -0,0 +1,201 @@
+/*
+	Hexes Terminal Library
+	Color functions. Brings colors down to what the terminal can display, using tables built at init.
+
+	Written by Richard Walmsley <richwalm@gmail.com>
+*/
+
+#include <stdio.h>
+#include <limits.h>
+
+#include "hexes.h"
+
+/* Five bits per channel is plenty, as the targets are so far apart. */
+#define	QUANT_BITS		5
+#define	QUANT_SIZE		(1 << (QUANT_BITS * 3))
+#define	GetQuantIndex(R, G, B)	((((R) >> (8 - QUANT_BITS)) << (QUANT_BITS * 2)) | (((G) >> (8 - QUANT_BITS)) << QUANT_BITS) | ((B) >> (8 - QUANT_BITS)))
+
+enum QuantTables {
+	QUANT_256,
+	QUANT_16,
+	QUANT_8,
+	QUANT_TABLES
+};
+
+static unsigned char QuantTables[QUANT_TABLES][QUANT_SIZE];
+static unsigned char PaletteTables[QUANT_TABLES][256];
+static int TablesBuilt;
+
+/* xterm's defaults. */
+static const unsigned char BasicPalette[16][3] = {
+	{ 0, 0, 0 }, { 205, 0, 0 }, { 0, 205, 0 }, { 205, 205, 0 },
+	{ 0, 0, 238 }, { 205, 0, 205 }, { 0, 205, 205 }, { 229, 229, 229 },
+	{ 127, 127, 127 }, { 255, 0, 0 }, { 0, 255, 0 }, { 255, 255, 0 },
+	{ 92, 92, 255 }, { 255, 0, 255 }, { 0, 255, 255 }, { 255, 255, 255 }
+};
+static const unsigned char CubeLevels[6] = { 0, 95, 135, 175, 215, 255 };
+
+/* Ordered dithering. */
+static const unsigned char Bayer[4][4] = {
+	{ 0, 8, 2, 10 },
+	{ 12, 4, 14, 6 },
+	{ 3, 11, 1, 9 },
+	{ 15, 7, 13, 5 }
+};
+
+static void GetPaletteRGB(unsigned int Index, int *R, int *G, int *B)
+{
+	if (Index < 16) {
+		*R = BasicPalette[Index][0]; *G = BasicPalette[Index][1]; *B = BasicPalette[Index][2];
+	} else if (Index < 232) {
+		Index -= 16;
+		*R = CubeLevels[Index / 36]; *G = CubeLevels[Index / 6 % 6]; *B = CubeLevels[Index % 6];
+	} else
+		*R = *G = *B = 8 + (Index - 232) * 10;
+	return;
+}
+
+static int GetColorDistance(int R1, int G1, int B1, int R2, int G2, int B2)
+{
+	return (R1 - R2) * (R1 - R2) + (G1 - G2) * (G1 - G2) + (B1 - B2) * (B1 - B2);
+}
+
+static int GetCubeLevel(int V)
+{
+	if (V < 48)
+		return 0;
+	if (V < 115)
+		return 1;
+	return (V - 35) / 40;
+}
+
+/* Nearest in the 6x6x6 cube or the gray ramp. */
+static unsigned int GetNearest256(int R, int G, int B)
+{
+	int CR, CG, CB, Gray;
+
+	CR = GetCubeLevel(R); CG = GetCubeLevel(G); CB = GetCubeLevel(B);
+
+	Gray = (R + G + B) / 3;
+	Gray = Gray < 8 ? 0 : Gray > 238 ? 23 : (Gray - 3) / 10;
+
+	if (GetColorDistance(R, G, B, 8 + Gray * 10, 8 + Gray * 10, 8 + Gray * 10) <
+		GetColorDistance(R, G, B, CubeLevels[CR], CubeLevels[CG], CubeLevels[CB]))
+		return 232 + Gray;
+
+	return 16 + CR * 36 + CG * 6 + CB;
+}
+
+static unsigned int GetNearestBasic(int R, int G, int B, unsigned int Count)
+{
+	unsigned int I, Best = 0;
+	int Distance, BestDistance = INT_MAX;
+
+	for (I = 0; I < Count; I++) {
+		Distance = GetColorDistance(R, G, B, BasicPalette[I][0], BasicPalette[I][1], BasicPalette[I][2]);
+		if (Distance < BestDistance) {
+			BestDistance = Distance;
+			Best = I;
+		}
+	}
+
+	return Best;
+}
+
+/* Each entry is worked out from the middle of the range it covers. */
+void BuildColorTables()
+{
+	const int Half = 1 << (7 - QUANT_BITS);
+	int R, G, B, I;
+
+	if (TablesBuilt)
+		return;
+
+	for (R = 0; R <= UCHAR_MAX; R += 1 << (8 - QUANT_BITS)) {
+		for (G = 0; G <= UCHAR_MAX; G += 1 << (8 - QUANT_BITS)) {
+			for (B = 0; B <= UCHAR_MAX; B += 1 << (8 - QUANT_BITS)) {
+				I = GetQuantIndex(R, G, B);
+				QuantTables[QUANT_256][I] = GetNearest256(R + Half, G + Half, B + Half);
+				QuantTables[QUANT_16][I] = GetNearestBasic(R + Half, G + Half, B + Half, 16);
+				QuantTables[QUANT_8][I] = GetNearestBasic(R + Half, G + Half, B + Half, 8);
+			}
+		}
+	}
+
+	for (I = 0; I <= UCHAR_MAX; I++) {
+		GetPaletteRGB(I, &R, &G, &B);
+		PaletteTables[QUANT_256][I] = I;
+		PaletteTables[QUANT_16][I] = I < 16 ? I : GetNearestBasic(R, G, B, 16);
+		PaletteTables[QUANT_8][I] = I < 8 ? I : GetNearestBasic(R, G, B, 8);
+	}
+
+	TablesBuilt = 1;
+
+	return;
+}
+
+/* How many colors the terminal has, going by HexColors. 0 if there's no need to bring them down. */
+int GetTerminalColors()
+{
+	if (!HexColors || HexColors >= HEX_TRUECOLOR)
+		return 0;
+	/* The search in DetectColors() stops short of the last one. */
+	if (HexColors >= HEX_COL_OFFSET_TRUE - 1)
+		return 256;
+	if (HexColors >= HEX_COL_OFFSET_256 + 16)
+		return 16;
+	return 8;
+}
+
+static unsigned int GetTableColor(int Table, unsigned int Index)
+{
+	/* The basic colors start from 1. */
+	return Table == QUANT_256 ? HEX_COL_256(Index) : Index + 1;
+}
+
+/* Colors is 256, 16 or 8. The basic colors are always left alone, as the program picked those deliberately. */
+unsigned int QuantizeColor(unsigned int Color, int Colors)
+{
+	int Table;
+
+	if (!Colors || Color < HEX_COL_OFFSET_256)
+		return Color;
+
+	Table = Colors >= 256 ? QUANT_256 : Colors >= 16 ? QUANT_16 : QUANT_8;
+
+	if (Color < HEX_COL_OFFSET_TRUE) {
+		if (Table == QUANT_256)
+			return Color;
+		return GetTableColor(Table, PaletteTables[Table][Color - HEX_COL_OFFSET_256]);
+	}
+
+	Color -= HEX_COL_OFFSET_TRUE;
+	return GetTableColor(Table, QuantTables[Table][GetQuantIndex((Color >> 16) & UCHAR_MAX, (Color >> 8) & UCHAR_MAX, Color & UCHAR_MAX)]);
+}
+
+/* Like the above, but nudged by the position so areas of color come out as a pattern of the nearest ones. */
+unsigned int DitherColor(unsigned int Color, int Colors, int X, int Y)
+{
+	int R, G, B, Spread, Bias;
+
+	if (!Colors || Color < HEX_COL_OFFSET_256 || (Colors >= 256 && Color < HEX_COL_OFFSET_TRUE))
+		return Color;
+
+	if (Color < HEX_COL_OFFSET_TRUE)
+		GetPaletteRGB(Color - HEX_COL_OFFSET_256, &R, &G, &B);
+	else {
+		Color -= HEX_COL_OFFSET_TRUE;
+		R = (Color >> 16) & UCHAR_MAX; G = (Color >> 8) & UCHAR_MAX; B = Color & UCHAR_MAX;
+	}
+
+	/* Roughly the gap between neighbouring targets. */
+	Spread = Colors >= 256 ? 40 : 128;
+	Bias = (Bayer[Y & 3][X & 3] * 2 + 1) * Spread / 32 - Spread / 2;
+
+	R += Bias; G += Bias; B += Bias;
+	R = R < 0 ? 0 : R > UCHAR_MAX ? UCHAR_MAX : R;
+	G = G < 0 ? 0 : G > UCHAR_MAX ? UCHAR_MAX : G;
+	B = B < 0 ? 0 : B > UCHAR_MAX ? UCHAR_MAX : B;
+
+	return QuantizeColor(HEX_COL_TRUE(R, G, B), Colors);
+}
@@ -8,21 +8,44 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 
 #include "hexes.h"
 
+#define	MAX_PRIORITIES	8
+#define	ROW_BITS	(sizeof(unsigned long) * CHAR_BIT)
+#define	ROW_WORDS(H)	(((H) + ROW_BITS - 1) / ROW_BITS)
+
 int InitSub(int Stage);
 int GetTerminalSize(int *W, int *H);
 int IsUnicodeSupported();
 int ColorsSupported();
 void FreeSub();
 void HexSetTitle(const char *Title, const char *Icon);
+void BuildColorTables();
+void SelectCompareRoutines();
+void FreeClusters();
+static void HashBufferRows();
+void MarkDamage(int X, int Y, int W, int H);
 
 int Width, Height, Unicode, HexColors;
+unsigned int SkippedFrames;
+int Priorities[MAX_PRIORITIES][4], PriorityCount;
 
 HexBuffer *Current, *Buffer;
 char *Damage;
 int HasDamage;
+unsigned long *DamagedRows;
+int *DamageSpans;
+unsigned long long *RowHashes;
+
+/* What's drawn on & its damage. The same as the above, other than while flushing in the background, when the flush
+   works from its own copy. */
+HexBuffer *Terminal;
+char *TermDamage;
+unsigned long *TermRows;
+int *TermSpans;
+unsigned long long *TermHashes;
 
 int HexWidth() { return Current->W; }
 int HexHeight() { return Current->H; }
@@ -32,6 +55,7 @@ int HexInit(int MinW, int MinH, int Flags)
 {
 	int Return;
 	Width = Height = Unicode = HexColors = 0;
+	SkippedFrames = 0;
 
 	Return = InitSub(0);
 	if (Return != HEX_ERROR_NONE)
@@ -63,23 +87,32 @@ int HexInit(int MinW, int MinH, int Flags)
 	}
 
 	HexColors = (Flags & HEX_INIT_NO_COLOR_TEST) ? 0 : ColorsSupported();
+	BuildColorTables();
+	SelectCompareRoutines();
 
 	Return = InitSub(2);
 	if (Return != HEX_ERROR_NONE)
 		return Return;
 
 	/* Create the primary buffers. */
-	Buffer = HexNewBuffer(Width, Height);
+	Buffer = Terminal = HexNewBuffer(Width, Height);
 	Current = HexNewBuffer(Width, Height);
-	Damage = calloc(Width * Height, 1);
-	if (!(Current && Buffer && Damage)) {
+	Damage = TermDamage = calloc(Width * Height, 1);
+	DamagedRows = TermRows = calloc(ROW_WORDS(Height), sizeof(unsigned long));
+	DamageSpans = TermSpans = malloc(Height * 2 * sizeof(int));
+	RowHashes = TermHashes = malloc(Height * sizeof(unsigned long long));
+	if (!(Current && Buffer && Damage && DamagedRows && DamageSpans && RowHashes)) {
 		HexFreeBuffer(Buffer);
 		HexFreeBuffer(Current);
 		free(Damage);
+		free(DamagedRows);
+		free(DamageSpans);
+		free(RowHashes);
 		InitSub(-3);
 		return HEX_ERROR_MEMORY;
 	}
 	HasDamage = 0;
+	HashBufferRows();
 
 	InitSub(3);
 	HexSetTitle("Hexes Terminal Application", NULL);
@@ -87,12 +120,35 @@ int HexInit(int MinW, int MinH, int Flags)
 	return HEX_ERROR_NONE;
 }
 
+/* Areas drawn before anything else, so they're kept up to date when a flush is cut short. */
+int HexAddPriority(int X, int Y, int W, int H)
+{
+	int *P;
+
+	if (PriorityCount >= MAX_PRIORITIES || W <= 0 || H <= 0)
+		return 0;
+
+	P = Priorities[PriorityCount++];
+	P[0] = X; P[1] = Y; P[2] = W; P[3] = H;
+
+	return 1;
+}
+
+void HexClearPriorities()
+{
+	PriorityCount = 0;
+	return;
+}
+
 int ResizeBuffers()
 {
 	unsigned int DamageOffset;
 	int W, H;
 	HexBuffer *CurrentNew, *BufferNew;
 	char *DamageNew;
+	unsigned long *DamagedRowsNew;
+	int *DamageSpansNew;
+	unsigned long long *RowHashesNew;
 	size_t Size;
 
 	if (!GetTerminalSize(&W, &H))
@@ -109,22 +165,39 @@ int ResizeBuffers()
 	DamageNew = realloc(Damage, Size);
 	if (!DamageNew)
 		return 0;
-	Damage = DamageNew;
+	Damage = TermDamage = DamageNew;
 
-	/* Set damage to everything except to the first line as that should remain the same. */
+	DamagedRowsNew = realloc(DamagedRows, ROW_WORDS(H) * sizeof(unsigned long));
+	if (!DamagedRowsNew)
+		return 0;
+	DamagedRows = TermRows = DamagedRowsNew;
+
+	DamageSpansNew = realloc(DamageSpans, H * 2 * sizeof(int));
+	if (!DamageSpansNew)
+		return 0;
+	DamageSpans = TermSpans = DamageSpansNew;
+
+	/* Set damage to everything except to the first line as that should remain the same. The rows are all marked, as the
+	   spans were for the old width. */
 	DamageOffset = W < Width ? W : Width;
-	if (DamageOffset < Size) {
+	memset(DamagedRows, 0, ROW_WORDS(H) * sizeof(unsigned long));
+	if (DamageOffset < Size)
 		memset(&DamageNew[DamageOffset], 1, Size - DamageOffset);
-		HasDamage = 1;
-	}
+	MarkDamage(0, 0, W, H);
 
 	BufferNew = HexResizeBuffer(Buffer, W, H);
 	if (!BufferNew)
 		return 0;
-	Buffer = BufferNew;
+	Buffer = Terminal = BufferNew;
+
+	RowHashesNew = realloc(RowHashes, H * sizeof(unsigned long long));
+	if (!RowHashesNew)
+		return 0;
+	RowHashes = TermHashes = RowHashesNew;
 
 	Width = W;
 	Height = H;
+	HashBufferRows();
 
 	return 1;
 }
@@ -136,6 +209,131 @@ void HexFree()
 	HexFreeBuffer(Current);
 	HexFreeBuffer(Buffer);
 	free(Damage);
+	free(DamagedRows);
+	free(DamageSpans);
+	free(RowHashes);
+	FreeClusters();
+
+	return;
+}
+
+/* Damage. Besides a byte for each cell, there's a bit for each row with any & the span of columns they fall within, so
+   the flush only needs to look at what's changed. A row's span is only kept while its bit is set. */
+int IsRowSet(const unsigned long *Rows, int Y)
+{
+	return Rows[Y / ROW_BITS] >> (Y % ROW_BITS) & 1;
+}
+
+int IsRowDamaged(int Y)
+{
+	return IsRowSet(DamagedRows, Y);
+}
+
+/* Returns the first set row from Y, or Height if there's none. */
+int NextRowSet(const unsigned long *Rows, int Y)
+{
+	unsigned long Bits;
+	int Word;
+
+	if (Y >= Height)
+		return Height;
+
+	Word = Y / ROW_BITS;
+	Bits = Rows[Word] & (~0UL << (Y % ROW_BITS));
+
+	while (!Bits) {
+		if (++Word >= (int)ROW_WORDS(Height))
+			return Height;
+		Bits = Rows[Word];
+	}
+
+#if defined(__GNUC__)
+	Y = Word * ROW_BITS + __builtin_ctzl(Bits);
+#else
+	for (Y = Word * ROW_BITS; !(Bits & 1); Bits >>= 1, Y++);
+#endif
+
+	return Y < Height ? Y : Height;
+}
+
+int NextDamagedRow(int Y)
+{
+	return NextRowSet(DamagedRows, Y);
+}
+
+/* Sets the rows' bits, widening their spans to take in the columns. */
+void MarkRows(unsigned long *Rows, int *Spans, int X, int Y, int W, int H)
+{
+	int *Span;
+
+	for (; H > 0; Y++, H--) {
+		Span = &Spans[Y * 2];
+
+		if (!IsRowSet(Rows, Y)) {
+			Rows[Y / ROW_BITS] |= 1UL << (Y % ROW_BITS);
+			Span[0] = X;
+			Span[1] = X + W;
+			continue;
+		}
+
+		if (X < Span[0])
+			Span[0] = X;
+		if (X + W > Span[1])
+			Span[1] = X + W;
+	}
+
+	return;
+}
+
+/* For when the bytes have been set already. */
+void MarkDamage(int X, int Y, int W, int H)
+{
+	MarkRows(DamagedRows, DamageSpans, X, Y, W, H);
+	HasDamage = 1;
+
+	return;
+}
+
+/* Likewise, for what's been drawn on the terminal buffer. */
+void MarkBufferDamage(int X, int Y, int W, int H)
+{
+	if (Terminal == Buffer)
+		MarkDamage(X, Y, W, H);
+	else
+		MarkRows(TermRows, TermSpans, X, Y, W, H);
+
+	return;
+}
+
+void SetDamage(int X, int Y, int W, int H)
+{
+	int Row;
+
+	for (Row = Y; Row < Y + H; Row++)
+		memset(&Damage[Row * Width + X], 1, W);
+	MarkDamage(X, Y, W, H);
+
+	return;
+}
+
+void ClearRowDamage(int Y)
+{
+	const int *Span = &DamageSpans[Y * 2];
+
+	if (!IsRowDamaged(Y))
+		return;
+
+	memset(&Damage[Y * Width + Span[0]], 0, Span[1] - Span[0]);
+	DamagedRows[Y / ROW_BITS] &= ~(1UL << (Y % ROW_BITS));
+
+	return;
+}
+
+void ClearDamage()
+{
+	memset(Damage, 0, Width * Height);
+	memset(DamagedRows, 0, ROW_WORDS(Height) * sizeof(unsigned long));
+	HasDamage = 0;
 
 	return;
 }
@@ -151,6 +349,66 @@ int IsSameChar(const HexChar *A, const HexChar *B)
 	return 0;
 }
 
+/* Row hashes. Kept for each row of the terminal buffer as it's drawn on, so the flush can pass over rows that haven't changed.
+   A cell's hash depends on its column, letting the row's be a sum that's updated a cell at a time. */
+static unsigned long long MixHash(unsigned long long H)
+{
+	H = (H ^ (H >> 30)) * 0xBF58476D1CE4E5B9ULL;	/* SplitMix64 */
+	H = (H ^ (H >> 27)) * 0x94D049BB133111EBULL;
+
+	return H ^ (H >> 31);
+}
+
+/* Mirrors IsSameChar(), so the bytes past the end of a character don't count. */
+unsigned long long GetCellHash(const HexChar *C, unsigned int X)
+{
+	unsigned long long CP = 0;
+	int I;
+
+	for (I = 0; I < UTF8_MAX_BYTES && C->CP[I]; I++)
+		CP |= (unsigned long long)(unsigned char)C->CP[I] << (I * 8);
+
+	return MixHash(MixHash((CP | (unsigned long long)C->FG << 32) + X * 0x9E3779B97F4A7C15ULL) ^
+		(C->BG | (unsigned long long)C->Attr << 32));
+}
+
+unsigned long long GetRowHash(const HexChar *C)
+{
+	unsigned long long Hash = 0;
+	int X;
+
+	for (X = 0; X < Width; X++)
+		Hash += GetCellHash(&C[X], X);
+
+	return Hash;
+}
+
+static void HashBufferRows()
+{
+	int Y;
+
+	for (Y = 0; Y < Height; Y++)
+		RowHashes[Y] = GetRowHash(&Buffer->Data[Y * Width]);
+
+	return;
+}
+
+/* Called once a cell of the terminal buffer has been written, with what it held before. If it changed, its byte of
+   damage is set & 1 returned, leaving the caller to mark the row. */
+int UpdateBufferCell(unsigned int Offset, const HexChar *Old)
+{
+	const HexChar *New = &Terminal->Data[Offset];
+	unsigned int X = Offset % Terminal->W;
+
+	if (IsSameChar(Old, New))
+		return 0;
+
+	TermHashes[Offset / Terminal->W] += GetCellHash(New, X) - GetCellHash(Old, X);
+	TermDamage[Offset] = 1;
+
+	return 1;
+}
+
 int GetU8Size(const unsigned char *Char)
 {
 	if (!Unicode || *Char < 0xC0)	/* Technically, 0x80 to 0xBF is invalid, but we'll just pass bad data. */
@@ -180,5 +438,5 @@ void HexClipCursor(int *X, int *Y)
 
 HexBuffer *HexGetTerminalBuffer()
 {
-	return Buffer;
+	return Terminal;
 }
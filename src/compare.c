@@ -0,0 +1,344 @@
+/*
+	Hexes Terminal Library
+	Cell comparison. Compares spans of cells a block at a time where the CPU allows, for the flush to find what needs drawing.
+	The vector variants are all built, with the widest the CPU supports picked at init.
+
+	Written by Richard Walmsley <richwalm@gmail.com>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hexes.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	#include <immintrin.h>
+	#define	VECTOR_DISPATCH
+	#define	ALWAYS_INLINE	inline __attribute__((always_inline))
+	#define	TARGET(T)	__attribute__((target(T)))
+#else
+	#define	ALWAYS_INLINE	inline
+#endif
+
+extern char *Damage;
+
+int IsSameChar(const HexChar *A, const HexChar *B);
+
+/* The vector variants compare cells whole, so they depend on HexChar being 16 bytes. Bytes past the end of a character
+   may differ without it changing, so cells that don't match are checked again with IsSameChar(). */
+#define	VECTOR_CELLS	(sizeof(HexChar) == 16)
+
+/* In order, so a level may be forced lower than what the CPU supports with HEX_CPU. */
+enum CompareLevels {
+	LEVEL_SCALAR,
+	LEVEL_SSE2,
+	LEVEL_AVX2,
+	LEVEL_AVX512,
+	LEVELS
+};
+
+static const char *LevelNames[] = { "scalar", "sse2", "avx2", "avx512" };
+
+/* Skips ahead to the next damaged cell. */
+static unsigned int SkipUndamagedScalar(unsigned int I, unsigned int End)
+{
+	const char *Next;
+
+	Next = I < End ? memchr(&Damage[I], 1, End - I) : NULL;
+
+	return Next ? Next - Damage : End;
+}
+
+#if defined(VECTOR_DISPATCH)
+
+/* Each checks a block of damage at once, along with a block of cells. The cell blocks return a bit for each cell that's
+   byte for byte the same. */
+TARGET("sse2") static unsigned int SkipUndamagedSSE2(unsigned int I, unsigned int End)
+{
+	unsigned int Mask;
+
+	for (; I + 16 <= End; I += 16) {
+		Mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&Damage[I]), _mm_setzero_si128())) & 0xFFFF;
+		if (Mask)
+			return I + __builtin_ctz(Mask);
+	}
+
+	for (; I < End && !Damage[I]; I++);
+
+	return I;
+}
+
+TARGET("sse2") static unsigned int GetSameSSE2(const HexChar *A, const HexChar *B)
+{
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)A), _mm_loadu_si128((const __m128i *)B))) == 0xFFFF;
+}
+
+TARGET("avx2") static unsigned int SkipUndamagedAVX2(unsigned int I, unsigned int End)
+{
+	unsigned int Mask;
+
+	for (; I + 32 <= End; I += 32) {
+		Mask = ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)&Damage[I]), _mm256_setzero_si256()));
+		if (Mask)
+			return I + __builtin_ctz(Mask);
+	}
+
+	return SkipUndamagedSSE2(I, End);
+}
+
+TARGET("avx2") static unsigned int GetSameAVX2(const HexChar *A, const HexChar *B)
+{
+	unsigned int Mask;
+
+	Mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)A), _mm256_loadu_si256((const __m256i *)B)));
+
+	return ((Mask & 0xFFFF) == 0xFFFF) | ((Mask >> 16) == 0xFFFF) << 1;
+}
+
+TARGET("avx512f,avx512bw") static unsigned int SkipUndamagedAVX512(unsigned int I, unsigned int End)
+{
+	unsigned long long Mask;
+	__m512i D;
+
+	for (; I + 64 <= End; I += 64) {
+		D = _mm512_loadu_si512((const void *)&Damage[I]);
+		Mask = _mm512_test_epi8_mask(D, D);
+		if (Mask)
+			return I + __builtin_ctzll(Mask);
+	}
+
+	return SkipUndamagedAVX2(I, End);
+}
+
+/* Compared as words, with a cell's 4 bits needing to all be set. */
+TARGET("avx512f,avx512bw") static unsigned int GetSameAVX512(const HexChar *A, const HexChar *B)
+{
+	unsigned int Mask, Same = 0, C;
+
+	Mask = _mm512_cmpeq_epi32_mask(_mm512_loadu_si512((const void *)A), _mm512_loadu_si512((const void *)B));
+	for (C = 0; C < 4; C++)
+		Same |= ((Mask >> (C * 4) & 0xF) == 0xF) << C;
+
+	return Same;
+}
+
+#endif
+
+/* These pick the level's kernels. With the level a constant in each variant, they're reduced to a single call. */
+static ALWAYS_INLINE unsigned int GetBlockCells(int Level)
+{
+	if (!VECTOR_CELLS || Level == LEVEL_SCALAR)
+		return 0;
+
+	return Level == LEVEL_AVX512 ? 4 : Level == LEVEL_AVX2 ? 2 : 1;
+}
+
+static ALWAYS_INLINE unsigned int SkipUndamagedWith(unsigned int I, unsigned int End, int Level)
+{
+	switch (Level) {
+#if defined(VECTOR_DISPATCH)
+		case LEVEL_SSE2:
+			return SkipUndamagedSSE2(I, End);
+		case LEVEL_AVX2:
+			return SkipUndamagedAVX2(I, End);
+		case LEVEL_AVX512:
+			return SkipUndamagedAVX512(I, End);
+#endif
+		default:
+			return SkipUndamagedScalar(I, End);
+	}
+}
+
+static ALWAYS_INLINE unsigned int GetSameWith(const HexChar *A, const HexChar *B, int Level)
+{
+	switch (Level) {
+#if defined(VECTOR_DISPATCH)
+		case LEVEL_SSE2:
+			return GetSameSSE2(A, B);
+		case LEVEL_AVX2:
+			return GetSameAVX2(A, B);
+		case LEVEL_AVX512:
+			return GetSameAVX512(A, B);
+#endif
+		default:
+			return 0;
+	}
+}
+
+/* Returns the first damaged cell from I up to End where A & B differ, or End if there's none. The damage is cleared for
+   those along the way that turned out to be the same. */
+static ALWAYS_INLINE unsigned int FindChangeWith(const HexChar *A, const HexChar *B, unsigned int I, unsigned int End, int Level)
+{
+	const unsigned int Cells = GetBlockCells(Level);
+	unsigned int Same, Run;
+
+	for (I = SkipUndamagedWith(I, End, Level); I < End; I = SkipUndamagedWith(I, End, Level)) {
+		/* Those which match from the start of the block are passed over together. */
+		if (Cells && I + Cells <= End) {
+			Same = GetSameWith(&A[I], &B[I], Level);
+			if (Same & 1) {
+				for (Run = 1; Run < Cells && Same >> Run & 1; Run++);
+				memset(&Damage[I], 0, Run);
+				I += Run;
+				continue;
+			}
+		}
+
+		if (!IsSameChar(&A[I], &B[I]))
+			return I;
+		Damage[I++] = 0;
+	}
+
+	return End;
+}
+
+/* How many cells differ between the spans. */
+static ALWAYS_INLINE unsigned int CountChangesWith(const HexChar *A, const HexChar *B, unsigned int Count, int Level)
+{
+	const unsigned int Cells = GetBlockCells(Level), All = (1U << Cells) - 1;
+	unsigned int I = 0, C, Same, Changes = 0;
+
+	if (Cells) {
+		for (; I + Cells <= Count; I += Cells) {
+			Same = GetSameWith(&A[I], &B[I], Level);
+			if (Same == All)
+				continue;
+
+			for (C = 0; C < Cells; C++)
+				Changes += !(Same >> C & 1) && !IsSameChar(&A[I + C], &B[I + C]);
+		}
+	}
+
+	for (; I < Count; I++)
+		Changes += !IsSameChar(&A[I], &B[I]);
+
+	return Changes;
+}
+
+static ALWAYS_INLINE int IsSameSpanWith(const HexChar *A, const HexChar *B, unsigned int Count, int Level)
+{
+	const unsigned int Cells = GetBlockCells(Level), All = (1U << Cells) - 1;
+	unsigned int I = 0, C, Same;
+
+	if (Cells) {
+		for (; I + Cells <= Count; I += Cells) {
+			Same = GetSameWith(&A[I], &B[I], Level);
+			if (Same == All)
+				continue;
+
+			for (C = 0; C < Cells; C++) {
+				if (!(Same >> C & 1) && !IsSameChar(&A[I + C], &B[I + C]))
+					return 0;
+			}
+		}
+	}
+
+	for (; I < Count; I++) {
+		if (!IsSameChar(&A[I], &B[I]))
+			return 0;
+	}
+
+	return 1;
+}
+
+/* A variant of each for every level, built for that level's instructions. */
+typedef struct CompareRoutines {
+	unsigned int (*FindChange)(const HexChar *A, const HexChar *B, unsigned int I, unsigned int End);
+	unsigned int (*CountChanges)(const HexChar *A, const HexChar *B, unsigned int Count);
+	int (*IsSameSpan)(const HexChar *A, const HexChar *B, unsigned int Count);
+} CompareRoutines;
+
+#define	COMPARE_VARIANT(Level, Name, Attributes) \
+	Attributes static unsigned int FindChange##Name(const HexChar *A, const HexChar *B, unsigned int I, unsigned int End) \
+	{ \
+		return FindChangeWith(A, B, I, End, Level); \
+	} \
+	Attributes static unsigned int CountChanges##Name(const HexChar *A, const HexChar *B, unsigned int Count) \
+	{ \
+		return CountChangesWith(A, B, Count, Level); \
+	} \
+	Attributes static int IsSameSpan##Name(const HexChar *A, const HexChar *B, unsigned int Count) \
+	{ \
+		return IsSameSpanWith(A, B, Count, Level); \
+	}
+
+#define	COMPARE_ROUTINES(Name)	{ FindChange##Name, CountChanges##Name, IsSameSpan##Name }
+
+COMPARE_VARIANT(LEVEL_SCALAR, Scalar, )
+#if defined(VECTOR_DISPATCH)
+COMPARE_VARIANT(LEVEL_SSE2, SSE2, TARGET("sse2"))
+COMPARE_VARIANT(LEVEL_AVX2, AVX2, TARGET("avx2"))
+COMPARE_VARIANT(LEVEL_AVX512, AVX512, TARGET("avx512f,avx512bw"))
+#endif
+
+static const CompareRoutines CompareVariants[] = {
+	COMPARE_ROUTINES(Scalar),
+#if defined(VECTOR_DISPATCH)
+	COMPARE_ROUTINES(SSE2),
+	COMPARE_ROUTINES(AVX2),
+	COMPARE_ROUTINES(AVX512)
+#endif
+};
+
+/* Scalar until the level is picked. */
+static const CompareRoutines *Compare = &CompareVariants[LEVEL_SCALAR];
+static int CompareLevel = LEVEL_SCALAR;
+
+unsigned int FindChange(const HexChar *A, const HexChar *B, unsigned int I, unsigned int End)
+{
+	return Compare->FindChange(A, B, I, End);
+}
+
+unsigned int CountChanges(const HexChar *A, const HexChar *B, unsigned int Count)
+{
+	return Compare->CountChanges(A, B, Count);
+}
+
+int IsSameSpan(const HexChar *A, const HexChar *B, unsigned int Count)
+{
+	return Compare->IsSameSpan(A, B, Count);
+}
+
+static int GetSupportedLevel()
+{
+#if defined(VECTOR_DISPATCH)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+		return LEVEL_AVX512;
+	if (__builtin_cpu_supports("avx2"))
+		return LEVEL_AVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return LEVEL_SSE2;
+#endif
+
+	return LEVEL_SCALAR;
+}
+
+/* Picks the widest level the CPU supports. HEX_CPU can name a lower one, mostly for testing them. Names that are unknown
+   or beyond what the CPU supports leave it at the widest, which HexCPULevel() shows. */
+void SelectCompareRoutines()
+{
+	const char *Env;
+	int Level, I;
+
+	Level = GetSupportedLevel();
+
+	Env = getenv("HEX_CPU");
+	if (Env) {
+		for (I = 0; I < LEVELS && strcmp(Env, LevelNames[I]); I++);
+		if (I <= Level)
+			Level = I;
+	}
+
+	Compare = &CompareVariants[Level];
+	CompareLevel = Level;
+
+	return;
+}
+
+/* The name of the level in use. */
+const char *HexCPULevel()
+{
+	return LevelNames[CompareLevel];
+}
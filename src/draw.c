@@ -12,12 +12,20 @@
 #include "hexes.h"
 
 #define GetOffset(X, Y, W) ((Y) * (W) + (X))
+#define	DRAW_ALL	(HEX_DRAW_CP | HEX_DRAW_FG | HEX_DRAW_BG | HEX_DRAW_ATTR)
 
-extern HexBuffer *Buffer;
-extern char *Damage;
-extern int HasDamage;
+extern HexBuffer *Terminal;
 
 int GetU8Size(const char *Char);
+int GetCharWidth(const char *CP);
+int GetClusterSize(const char *String, size_t Length);
+int InternCluster(char *CP, const char *String, int Size);
+void RecordFill(int X, int Y, int W, int H, const HexChar *Char, unsigned int Flags);
+int UpdateBufferCell(unsigned int Offset, const HexChar *Old);
+void ReadCell(const HexBuffer *B, unsigned int Offset, HexChar *C);
+void WriteCell(HexBuffer *B, unsigned int Offset, const HexChar *C);
+int FillArea(HexBuffer *D, int DX, int DY, int W, int H, const HexChar *Char, unsigned int Flags);
+void MarkBufferDamage(int X, int Y, int W, int H);
 
 void HexLocate(HexBuffer *B, int X, int Y)
 {
@@ -60,34 +68,84 @@ static void UpdateCursor(HexBuffer *B)
 	return;
 }
 
-int HexPutChar(HexBuffer *B, const char *CP)
+/* Anything joining onto the character is taken along with it, reading no more than Length. */
+static int PutChar(HexBuffer *B, const char *CP, size_t Length)
 {
-	int Size;
+	int Size, Bytes, Columns;
+	char Char[UTF8_MAX_BYTES];
+
+	Size = Bytes = GetU8Size(CP);
+	Columns = GetCharWidth(CP);
+
+	/* There's no cell for these to go in, as combining characters would need to share one. */
+	if (!Columns)
+		return Size;
+
+	/* Clusters are given a handle to store in the cell instead. */
+	Size = GetClusterSize(CP, Length);
+	if (Size > Bytes) {
+		Columns = InternCluster(Char, CP, Size);
+		CP = Char;
+		Bytes = GetU8Size(CP);
+	}
 
-	Size = GetU8Size(CP);
+	/* With no room for both halves on any line, they're drawn as a space. */
+	if (Columns > 1 && B->W < 2) {
+		CP = " ";
+		Bytes = Columns = 1;
+	}
 
-	if (!(B->X < 0 || B->Y < 0 || B->X >= B->W || B->Y >= B->H || (Size == 1 && iscntrl((int)*CP)))) {
-		int I;
-		HexChar *C;
+	/* Like on the terminal, wide characters go onto the next line rather than be split. */
+	if (Columns > 1 && B->X == B->W - 1)
+		UpdateCursor(B);
 
+	if (!(B->X < 0 || B->Y < 0 || B->X + Columns > B->W || B->Y >= B->H || (Size == 1 && iscntrl((int)*CP)))) {
+		int I, J;
+		HexChar *C, Old[2], Cells[2];
+
+		/* Planar buffers are drawn on as whole cells, then written back. */
 		I = GetOffset(B->X, B->Y, B->W);
-		C = &B->Data[I];
-		strncpy(C->CP, CP, Size);
-		if (Size < UTF8_MAX_BYTES)
-			C->CP[Size] = '\0';
+		if (B->Data)
+			C = &B->Data[I];
+		else {
+			for (J = 0; J < Columns; J++)
+				ReadCell(B, I + J, &Cells[J]);
+			C = Cells;
+		}
+		memcpy(Old, C, sizeof(HexChar) * Columns);
+		strncpy(C->CP, CP, Bytes);
+		if (Bytes < UTF8_MAX_BYTES)
+			C->CP[Bytes] = '\0';
 		C->Attr = B->Attr;
 		C->FG = B->FG;
 		C->BG = B->BG;
 
-		if (B == Buffer)
-			HasDamage = Damage[I] = 1;
+		if (Columns > 1) {
+			C[1] = *C;
+			memset(C[1].CP, 0, UTF8_MAX_BYTES);
+			memcpy(C[1].CP, HEX_WIDE_TAIL, sizeof(HEX_WIDE_TAIL) - 1);
+		}
+
+		if (!B->Data) {
+			for (J = 0; J < Columns; J++)
+				WriteCell(B, I + J, &Cells[J]);
+		} else if (B == Terminal && (UpdateBufferCell(I, &Old[0]) | (Columns > 1 && UpdateBufferCell(I + 1, &Old[1]))))
+			MarkBufferDamage(B->X, B->Y, Columns, 1);
 	}
 
 	UpdateCursor(B);
+	if (Columns > 1)
+		UpdateCursor(B);
 
 	return Size;
 }
 
+/* Only the one character is read, as it may not be terminated. Clusters are left to HexPrint(). */
+int HexPutChar(HexBuffer *B, const char *CP)
+{
+	return PutChar(B, CP, GetU8Size(CP));
+}
+
 int HexPrint(HexBuffer *B, const char *String, size_t Length)
 {
 	unsigned int I;
@@ -120,7 +178,7 @@ int HexPrint(HexBuffer *B, const char *String, size_t Length)
 				B->X += B->TabStop - (B->X % B->TabStop);
 				break;
 			default:
-				Size = HexPutChar(B, String);
+				Size = PutChar(B, String, Length - I);
 				break;
 		}
 
@@ -133,10 +191,18 @@ int HexPrint(HexBuffer *B, const char *String, size_t Length)
 
 void HexPutHexCharOffset(HexBuffer *D, unsigned int DOffset, const HexChar *Char)
 {
+	HexChar Old;
+
+	if (!D->Data) {
+		WriteCell(D, DOffset, Char);
+		return;
+	}
+
+	Old = D->Data[DOffset];
 	D->Data[DOffset] = *Char;
 
-	if (D == Buffer)
-		HasDamage = Damage[DOffset] = 1;
+	if (D == Terminal && UpdateBufferCell(DOffset, &Old))
+		MarkBufferDamage(DOffset % D->W, DOffset / D->W, 1, 1);
 
 	return;
 }
@@ -154,23 +220,35 @@ void HexPutHexChar(HexBuffer *D, int X, int Y, const HexChar *Char)
 /* Like blitting, may be called directly provided input is safe. */
 void HexFillRaw(HexBuffer *D, int DX, int DY, int W, int H, const HexChar *Char, unsigned int Flags)
 {
-	int Y;
+	int Y, IsBuffer;
 	unsigned int DOffset;
 	HexChar *DD;
 
 	if (!Flags)
-		Flags = ~0;
+		Flags = DRAW_ALL;
 
 	DOffset = GetOffset(DX, DY, D->W);
 	DD = D->Data;
 
+	IsBuffer = D == Terminal;
+	if (IsBuffer)
+		RecordFill(DX, DY, W, H, Char, Flags);
+	else if (FillArea(D, DX, DY, W, H, Char, Flags))
+		return;
+
 	for (Y = 0; Y < H; Y++) {
-		int X;
+		int X, From = W, To = 0;
 
 		for (X = 0; X < W; X++) {
-			HexChar *C;
+			HexChar *C, Old, Cell;
 
-			C = &DD[DOffset + X];
+			if (DD)
+				C = &DD[DOffset + X];
+			else {
+				ReadCell(D, DOffset + X, &Cell);
+				C = &Cell;
+			}
+			Old = *C;
 
 			if (Flags & HEX_DRAW_CP) {
 				int Size = GetU8Size(Char->CP);
@@ -186,10 +264,19 @@ void HexFillRaw(HexBuffer *D, int DX, int DY, int W, int H, const HexChar *Char,
 			if (Flags & HEX_DRAW_ATTR)
 				C->Attr = Char->Attr;
 
-			if (D == Buffer)
-				HasDamage = Damage[DOffset + X] = 1;
+			if (!DD)
+				WriteCell(D, DOffset + X, C);
+			else if (IsBuffer && UpdateBufferCell(DOffset + X, &Old)) {
+				if (From > X)
+					From = X;
+				To = X + 1;
+			}
 		}
 		DOffset += D->W;
+
+		/* Only the span that changed is marked, once for the row. */
+		if (From < To)
+			MarkBufferDamage(DX + From, DY + Y, To - From, 1);
 	}
 
 	return;
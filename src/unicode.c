@@ -0,0 +1,405 @@
+/*
+	Hexes Terminal Library
+	Unicode functions. Works out how many columns a character takes up on the terminal, & keeps the grapheme clusters
+	that are too long for a cell.
+
+	Written by Richard Walmsley <richwalm@gmail.com>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hexes.h"
+
+extern int Unicode;
+
+int GetU8Size(const unsigned char *Char);
+
+typedef struct CodePointRange {
+	unsigned int First, Last;
+} CodePointRange;
+
+#include "unicode_tables.h"
+
+#define	RANGE_COUNT(R)	(sizeof(R) / sizeof(*(R)))
+
+static int IsInRanges(unsigned int CP, const CodePointRange *R, size_t Count)
+{
+	size_t Min, Max, Middle;
+
+	if (!Count || CP < R[0].First || CP > R[Count - 1].Last)
+		return 0;
+
+	Min = 0;
+	Max = Count - 1;
+	while (Min <= Max) {
+		Middle = (Min + Max) / 2;
+		if (CP > R[Middle].Last)
+			Min = Middle + 1;
+		else if (CP < R[Middle].First) {
+			if (!Middle)
+				break;
+			Max = Middle - 1;
+		} else
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Returns -1 if it's not valid UTF-8. */
+static long GetCodePoint(const unsigned char *Char)
+{
+	long CP;
+	int I, Size;
+
+	if (*Char < 0x80)
+		return *Char;
+	else if (*Char < 0xC0)
+		return -1;
+	else if (*Char < 0xE0) {
+		CP = *Char & 0x1F;
+		Size = 2;
+	} else if (*Char < 0xF0) {
+		CP = *Char & 0x0F;
+		Size = 3;
+	} else if (*Char < 0xF8) {
+		CP = *Char & 0x07;
+		Size = 4;
+	} else
+		return -1;
+
+	for (I = 1; I < Size; I++) {
+		if ((Char[I] & 0xC0) != 0x80)
+			return -1;
+		CP = (CP << 6) | (Char[I] & 0x3F);
+	}
+
+	return CP;
+}
+
+/* Columns taken up by the character, 0 to 2. Bad data takes up a column & is shown as a space, by GetCellBytes(). */
+int GetCharWidth(const char *CP)
+{
+	long Code;
+
+	if (!Unicode || !(*CP & 0x80))
+		return 1;
+
+	Code = GetCodePoint((const unsigned char *)CP);
+	if (Code < 0)
+		return 1;
+	if (IsInRanges(Code, ZeroWidthRanges, RANGE_COUNT(ZeroWidthRanges)))
+		return 0;
+	if (IsInRanges(Code, WideRanges, RANGE_COUNT(WideRanges)))
+		return 2;
+
+	return 1;
+}
+
+/* Grapheme clusters. A character followed by others that join onto it, such as combining marks, variation selectors,
+   emoji modifiers & ZWJ sequences, is drawn in a single cell. As that won't fit in the cell, it's kept in a pool with the
+   cell holding a handle to it. The handle's bytes are all non-zero, so cells can still be compared & hashed as before.
+   Clusters are deduplicated & kept until HexFree(). Indexes aren't used again afterwards, so handles left from before
+   are shown as a space rather than as another cluster. */
+#define	CLUSTER_MARK	((unsigned char)*HEX_CLUSTER)
+#define	CLUSTER_BITS	21
+#define	MAX_CLUSTERS	(1U << CLUSTER_BITS)
+#define	MAX_CLUSTER_BYTES	64
+
+#define	CLUSTER_PAGE	1024
+#define	CLUSTER_BLOCK	4096
+
+#define	ZWJ	0x200D
+#define	VS16	0xFE0F
+#define	IsRegional(C)	((C) >= 0x1F1E6 && (C) <= 0x1F1FF)
+#define	IsEmojiModifier(C)	((C) >= 0x1F3FB && (C) <= 0x1F3FF)
+
+typedef struct Cluster {
+	const char *Bytes;
+	unsigned char Size, Width;
+} Cluster;
+
+/* Neither the pages nor the blocks holding the bytes are ever moved, as the flush may be reading them from another
+   thread. The table used to find existing clusters is only used when drawing. */
+static Cluster *ClusterPages[MAX_CLUSTERS / CLUSTER_PAGE];
+static unsigned int ClusterCount, ClusterFirst;
+
+static char *Block;
+static size_t BlockUsed;
+
+static unsigned int *ClusterTable, TableSize;
+
+/* Whether the code point joins onto the cluster, given its first & last so far. */
+static int IsJoined(long First, long Last, long Code)
+{
+	if (Last == ZWJ)
+		return Code >= 0x80;
+	if (IsRegional(Code))
+		return Last == First && IsRegional(First);
+	if (IsEmojiModifier(Code))
+		return IsInRanges(Last, WideRanges, RANGE_COUNT(WideRanges));
+
+	return IsInRanges(Code, ZeroWidthRanges, RANGE_COUNT(ZeroWidthRanges));
+}
+
+/* Bytes taken up by the cluster at the start of the string, reading no more than Length. */
+int GetClusterSize(const char *String, size_t Length)
+{
+	const unsigned char *S = (const unsigned char *)String;
+	long First, Last, Code;
+	size_t Size, Next;
+
+	Size = GetU8Size(S);
+	if (!Unicode)
+		return Size;
+
+	First = Last = GetCodePoint(S);
+	if (First < 0)
+		return Size;
+
+	while (Size < Length && S[Size]) {
+		Next = GetU8Size(&S[Size]);
+		if (Size + Next > Length || Size + Next > MAX_CLUSTER_BYTES)
+			break;
+
+		Code = GetCodePoint(&S[Size]);
+		if (Code < 0 || !IsJoined(First, Last, Code))
+			break;
+
+		Size += Next;
+		Last = Code;
+	}
+
+	return Size;
+}
+
+/* Taken from the first character, except for emoji presentation & flags, which terminals that join clusters show wide. */
+static int GetClusterWidth(const unsigned char *S, int Size)
+{
+	long Code;
+	int I, Width;
+
+	Width = GetCharWidth((const char *)S);
+	for (I = GetU8Size(S); I < Size && Width < 2; I += GetU8Size(&S[I])) {
+		Code = GetCodePoint(&S[I]);
+		if (Code == VS16 || IsRegional(Code))
+			Width = 2;
+	}
+
+	return Width;
+}
+
+static unsigned int HashCluster(const char *String, int Size)
+{
+	unsigned int Hash = 2166136261U;	/* FNV-1a */
+	int I;
+
+	for (I = 0; I < Size; I++)
+		Hash = (Hash ^ (unsigned char)String[I]) * 16777619U;
+
+	return Hash;
+}
+
+static Cluster *GetClusterEntry(unsigned int I)
+{
+	return &ClusterPages[I / CLUSTER_PAGE][I % CLUSTER_PAGE];
+}
+
+/* The table holds each cluster's index plus one, so empty slots are zero. It's kept no more than half full. */
+static int GrowClusterTable()
+{
+	unsigned int *Table, Size, I, Slot;
+	const Cluster *C;
+
+	Size = TableSize ? TableSize * 2 : CLUSTER_PAGE;
+	Table = calloc(Size, sizeof(unsigned int));
+	if (!Table)
+		return 0;
+
+	for (I = ClusterFirst; I < ClusterCount; I++) {
+		C = GetClusterEntry(I);
+		for (Slot = HashCluster(C->Bytes, C->Size) & (Size - 1); Table[Slot]; Slot = (Slot + 1) & (Size - 1));
+		Table[Slot] = I + 1;
+	}
+
+	free(ClusterTable);
+	ClusterTable = Table;
+	TableSize = Size;
+
+	return 1;
+}
+
+/* Each block starts with a pointer to the one before it, so they can be freed. */
+static const char *KeepBytes(const char *String, int Size)
+{
+	char *New;
+
+	if (!Block || BlockUsed + Size > CLUSTER_BLOCK) {
+		New = malloc(CLUSTER_BLOCK);
+		if (!New)
+			return NULL;
+		*(char **)New = Block;
+		Block = New;
+		BlockUsed = sizeof(char *);
+	}
+
+	New = &Block[BlockUsed];
+	memcpy(New, String, Size);
+	BlockUsed += Size;
+
+	return New;
+}
+
+static unsigned int AddCluster(const char *String, int Size)
+{
+	Cluster *Page, *C;
+	const char *Bytes;
+
+	if (ClusterCount >= MAX_CLUSTERS)
+		return 0;
+
+	Page = ClusterPages[ClusterCount / CLUSTER_PAGE];
+	if (!Page) {
+		Page = calloc(CLUSTER_PAGE, sizeof(Cluster));
+		if (!Page)
+			return 0;
+		ClusterPages[ClusterCount / CLUSTER_PAGE] = Page;
+	}
+
+	Bytes = KeepBytes(String, Size);
+	if (!Bytes)
+		return 0;
+
+	C = &Page[ClusterCount % CLUSTER_PAGE];
+	C->Bytes = Bytes;
+	C->Size = Size;
+	C->Width = GetClusterWidth((const unsigned char *)String, Size);
+
+	return ++ClusterCount;
+}
+
+/* Sets CP to the cluster, returning the columns it takes up. Should there be a single character, or it can't be kept,
+   the first character is used on its own. */
+int InternCluster(char *CP, const char *String, int Size)
+{
+	unsigned int Slot, Index;
+	const Cluster *C;
+	int First;
+
+	First = GetU8Size((const unsigned char *)String);
+	if (Size > First && ((ClusterCount - ClusterFirst + 1) * 2 <= TableSize || GrowClusterTable())) {
+		for (Slot = HashCluster(String, Size) & (TableSize - 1); (Index = ClusterTable[Slot]); Slot = (Slot + 1) & (TableSize - 1)) {
+			C = GetClusterEntry(Index - 1);
+			if (C->Size == Size && !memcmp(C->Bytes, String, Size))
+				break;
+		}
+
+		if (!Index) {
+			Index = AddCluster(String, Size);
+			if (Index)
+				ClusterTable[Slot] = Index;
+		}
+
+		if (Index--) {
+			CP[0] = (char)CLUSTER_MARK;
+			CP[1] = (char)(0x80 | (Index >> 14 & 0x7F));
+			CP[2] = (char)(0x80 | (Index >> 7 & 0x7F));
+			CP[3] = (char)(0x80 | (Index & 0x7F));
+			return GetClusterEntry(Index)->Width;
+		}
+	}
+
+	memset(CP, 0, UTF8_MAX_BYTES);
+	memcpy(CP, String, First);
+
+	return GetCharWidth(String);
+}
+
+/* Those left from before the pool was freed come back as NULL, to be shown as a space. */
+static const Cluster *GetCluster(const char *CP)
+{
+	const unsigned char *S = (const unsigned char *)CP;
+	const Cluster *Page;
+	unsigned int Index;
+
+	if (S[0] != CLUSTER_MARK || !(S[1] & S[2] & S[3] & 0x80))
+		return NULL;
+
+	Index = (S[1] & 0x7F) << 14 | (S[2] & 0x7F) << 7 | (S[3] & 0x7F);
+	Page = ClusterPages[Index / CLUSTER_PAGE];
+	if (!Page || !Page[Index % CLUSTER_PAGE].Bytes)
+		return NULL;
+
+	return &Page[Index % CLUSTER_PAGE];
+}
+
+int IsCluster(const char *CP)
+{
+	return GetCluster(CP) != NULL;
+}
+
+/* Columns taken up by what a cell holds. */
+int GetCellWidth(const char *CP)
+{
+	const Cluster *C = GetCluster(CP);
+
+	return C ? C->Width : GetCharWidth(CP);
+}
+
+/* The bytes to output for what a cell holds. */
+const char *GetCellBytes(const char *CP, size_t *Size)
+{
+	const Cluster *C = GetCluster(CP);
+
+	if (C) {
+		*Size = C->Size;
+		return C->Bytes;
+	}
+
+	if (Unicode && GetCodePoint((const unsigned char *)CP) < 0) {
+		*Size = 1;
+		return " ";
+	}
+
+	for (*Size = 1; *Size < UTF8_MAX_BYTES && CP[*Size]; (*Size)++);
+
+	return CP;
+}
+
+const char *HexGetCharBytes(const HexChar *Char, size_t *Size)
+{
+	if (!*Char->CP) {
+		*Size = 0;
+		return Char->CP;
+	}
+
+	return GetCellBytes(Char->CP, Size);
+}
+
+void FreeClusters()
+{
+	char *Previous;
+	unsigned int I;
+
+	for (I = ClusterFirst / CLUSTER_PAGE; I < MAX_CLUSTERS / CLUSTER_PAGE && ClusterPages[I]; I++) {
+		free(ClusterPages[I]);
+		ClusterPages[I] = NULL;
+	}
+
+	/* Carries on from the next page, leaving those freed empty. */
+	ClusterCount = ClusterFirst = (ClusterCount + CLUSTER_PAGE - 1) / CLUSTER_PAGE * CLUSTER_PAGE;
+
+	for (; Block; Block = Previous) {
+		Previous = *(char **)Block;
+		free(Block);
+	}
+	BlockUsed = 0;
+
+	free(ClusterTable);
+	ClusterTable = NULL;
+	TableSize = 0;
+
+	return;
+}
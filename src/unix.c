@@ -13,21 +13,42 @@
 #include <unistd.h>
 #include <limits.h>
 #include <signal.h>
+#include <termios.h>
+#include <time.h>
 
 #include "hexes.h"
 
 #define GetOffset(X, Y, W) ((Y) * (W) + (X))
 #define ESC	"\x1B"
 #define DETECT_TIMEOUT_MS		100
-#define	BUF_BYTES_PER_CELL		64
 
-extern HexBuffer *Buffer, *Current;
-extern int Width, Height;
+/* For the specialized variants of the drawing functions. */
+#ifdef __GNUC__
+	#define	ALWAYS_INLINE	inline __attribute__((always_inline))
+	#define	THREAD_LOCAL	_Thread_local __attribute__((tls_model("initial-exec")))
+#else
+	#define	ALWAYS_INLINE	inline
+	#define	THREAD_LOCAL	_Thread_local
+#endif
+
+extern HexBuffer *Buffer, *Current, *Terminal;
+extern int Width, Height, Unicode;
 extern char *Damage;
 extern int HasDamage;
+extern int *DamageSpans;
+extern unsigned long long *RowHashes;
+extern int Priorities[][4], PriorityCount;
 int Flags;
 
-static int OnRightEdge;
+/* Where the terminal's cursor is & the style it'll draw in. Each band of a parallel flush tracks its own. */
+typedef struct TermState {
+	int X, Y;	/* A negative Y if it's not known. */
+	unsigned int FG, BG, Attr;
+	int OnRightEdge;
+} TermState;
+
+static TermState MainTerm;
+static THREAD_LOCAL TermState *Term = &MainTerm;
 
 static struct sigaction OldResizeHandler, OldContinueHandler;
 
@@ -38,13 +59,72 @@ enum TermQuirks {
 	QUIRK_ABS_COL_CODE = 2,
 	QUIRK_WRAPPING_FIX = 4,
 	QUIRK_CURSOR_POS_CODE = 8,
-	QUIRK_NO_DEFAULT_COLORS_CODES = 16
+	QUIRK_NO_DEFAULT_COLORS_CODES = 16,
+	QUIRK_REP_CODE = 32,
+	QUIRK_ECH_CODE = 64,
+	QUIRK_BACK_COLOR_ERASE = 128,
+	QUIRK_SCROLL_REGION = 256,
+	QUIRK_SCROLL_CODES = 512,
+	QUIRK_INSERT_LINE_CODES = 1024,
+	QUIRK_INSERT_CHAR_CODE = 2048,
+	QUIRK_DELETE_CHAR_CODE = 4096,
+	QUIRK_RECT_CODES = 8192,
+	QUIRK_SYNC_OUTPUT = 16384
 } TermQuirks;
 static int Quirks;
 
+/* Single byte controls usable for cursor motion. */
+enum MotionControls {
+	MOTION_CR = 1,
+	MOTION_LF = 2,
+	MOTION_LF_RETURNS = 4
+} MotionControls;
+static int Motion, TabWidth;
+
 int ExtendOutputBuffer();
+int FlushOutput();
+int DrainOutput();
+int IsOutputBehind();
+size_t GetOutputTotal();
+size_t GetQueuedOutput();
+unsigned long GetOutputWaited();
+void FreeOutput();
+void OutputBytes(const char *Data, size_t Size);
+void OutputString(const char *String);
+void OutputFormat(const char *Format, ...);
+int ReserveChunks(int Count);
+void BeginChunk(int N);
+void EndChunk();
+int JoinChunk(int N);
+int StartWorkers();
+void RunJobs(void (*Job)(int N), int Count);
+void FreeWorkers();
+void StopAsync();
+void FreeAsync();
+void CountSkippedFrame();
+static void BuildSGRTables();
+static void BuildMoveTables();
+static void SelectDrawRoutines();
+int GetTerminalColors();
+unsigned int QuantizeColor(unsigned int Color, int Colors);
+int GetCellWidth(const char *CP);
+int IsCluster(const char *CP);
+const char *GetCellBytes(const char *CP, size_t *Size);
+static void FreeScrolling();
+static void FreeDrawnRows();
+static int CrossesWide(int X, int Y, int W, int H);
 int ResizeBuffers();
 int IsSameChar(const HexChar *A, const HexChar *B);
+unsigned int FindChange(const HexChar *A, const HexChar *B, unsigned int I, unsigned int End);
+unsigned int CountChanges(const HexChar *A, const HexChar *B, unsigned int Count);
+int IsSameSpan(const HexChar *A, const HexChar *B, unsigned int Count);
+unsigned long long GetRowHash(const HexChar *C);
+int IsRowDamaged(int Y);
+int NextDamagedRow(int Y);
+void MarkDamage(int X, int Y, int W, int H);
+void SetDamage(int X, int Y, int W, int H);
+void ClearRowDamage(int Y);
+void ClearDamage();
 void HexClipCursor(int *X, int *Y);
 
 int InitInput(int Stage);
@@ -55,8 +135,10 @@ int GetCharTimeout(int Timeout);
 /* We don't use all of it. */
 enum UnixHints {
 	HINT_BOOL_CA_NOT_RESTORE = 24,	/* nrrmc */
+	HINT_BOOL_BACK_COLOR_ERASE = 28,	/* bce */
 
 	HINT_INT_COLUMNS = 0,		/* cols */
+	HINT_INT_INIT_TABS = 1,		/* it */
 	HINT_INT_LINES = 2,		/* lines */
 	HINT_INT_MAX_COLORS = 13,	/* colors */
 
@@ -65,7 +147,16 @@ enum UnixHints {
 
 	HINT_STR_CURSOR_INVISIBLE = 13,	/* civis */
 	HINT_STR_CURSOR_NORMAL = 16,	/* cnorm */
-	HINT_STR_CURSOR_VISIBLE = 20	/* cvvis */
+	HINT_STR_CURSOR_VISIBLE = 20,	/* cvvis */
+
+	HINT_STR_CHANGE_SCROLL_REGION = 3,	/* csr */
+	HINT_STR_ERASE_CHARS = 37,	/* ech */
+	HINT_STR_PARM_DCH = 105,	/* dch */
+	HINT_STR_PARM_DELETE_LINE = 106,	/* dl */
+	HINT_STR_PARM_ICH = 108,	/* ich */
+	HINT_STR_PARM_INDEX = 109,	/* indn */
+	HINT_STR_PARM_INSERT_LINE = 110,	/* il */
+	HINT_STR_PARM_RINDEX = 113	/* rin */
 };
 int GetTermInfoBool(unsigned int N);
 int GetTermInfoInt(unsigned int N);
@@ -160,7 +251,7 @@ static int DetectQuirks()
 {
 	const char *TermEnv;
 	int Return;
-	char Buf[16];
+	char Buf[16], DABuf[96];
 	int X, Y, NewY;
 
 	Quirks = 0;
@@ -170,6 +261,24 @@ static int DetectQuirks()
 	if (TermEnv && strcasecmp("VT100", TermEnv) == 0)
 		Quirks |= QUIRK_NO_DEFAULT_COLORS_CODES;
 
+	/* ECH doesn't move the cursor, so can't be tested for. */
+	if (GetTermInfoString(HINT_STR_ERASE_CHARS))
+		Quirks |= QUIRK_ECH_CODE;
+	if (GetTermInfoBool(HINT_BOOL_BACK_COLOR_ERASE))
+		Quirks |= QUIRK_BACK_COLOR_ERASE;
+
+	/* Same with the scrolling codes. */
+	if (GetTermInfoString(HINT_STR_CHANGE_SCROLL_REGION))
+		Quirks |= QUIRK_SCROLL_REGION;
+	if (GetTermInfoString(HINT_STR_PARM_INDEX) && GetTermInfoString(HINT_STR_PARM_RINDEX))
+		Quirks |= QUIRK_SCROLL_CODES;
+	if (GetTermInfoString(HINT_STR_PARM_INSERT_LINE) && GetTermInfoString(HINT_STR_PARM_DELETE_LINE))
+		Quirks |= QUIRK_INSERT_LINE_CODES;
+	if (GetTermInfoString(HINT_STR_PARM_ICH))
+		Quirks |= QUIRK_INSERT_CHAR_CODE;
+	if (GetTermInfoString(HINT_STR_PARM_DCH))
+		Quirks |= QUIRK_DELETE_CHAR_CODE;
+
 	/* Minimal size needed for these tests. */
 	if (Width < 3 || Height < 2)
 		return 0;
@@ -216,6 +325,19 @@ static int DetectQuirks()
 	if (!X && Y == NewY)
 		Quirks |= QUIRK_LINE_CODES;
 
+	/* REP. Should move the cursor along as if the characters were printed. */
+	fputs("\r " ESC "[2b" ESC "[6n" ESC "[1K\r", stdout);
+	fflush(stdout);
+	Return = WaitForReply('R', Buf, sizeof(Buf));
+	if (Return)
+		return Return;
+
+	if (!ParseCursorPosition(Buf, &X, &Y))
+		return -1;
+
+	if (X == 3)
+		Quirks |= QUIRK_REP_CODE;
+
 	/* Wrapping fix. Can OnRightEdge be cleared with a single instruction. */
 	printf(ESC "[?7h" ESC "[%dC " ESC "[C " ESC "[6n\r", Width);
 	fflush(stdout);
@@ -229,9 +351,81 @@ static int DetectQuirks()
 	if (X != Width - 1)
 		Quirks |= QUIRK_WRAPPING_FIX;
 
+	/* Synchronized output is queried with DECRQM, which not every terminal will reply to. So the primary device
+	   attributes are asked for straight after, as those always are. Rectangular editing is listed as extension 28 in them. */
+	fputs(ESC "[?2026$p" ESC "[c", stdout);
+	fflush(stdout);
+	Return = WaitForReply('c', DABuf, sizeof(DABuf));
+	if (Return == -1)
+		return Return;
+
+	if (!Return) {
+		char *C, *Next;
+
+		/* Set or reset, rather than unknown or permanent. */
+		C = strstr(DABuf, "[?2026;");
+		if (C) {
+			X = atoi(C + 7);
+			if (X == 1 || X == 2)
+				Quirks |= QUIRK_SYNC_OUTPUT;
+		}
+
+		/* The device attributes come last. */
+		for (C = NULL, Next = DABuf; (Next = strstr(Next, "[?")); Next += 2)
+			C = Next;
+		if (C) {
+			C += 2;
+			/* Skip the conformance level. */
+			strtol(C, &C, 10);
+			while (*C == ';') {
+				if (strtol(C + 1, &C, 10) == 28) {
+					Quirks |= QUIRK_RECT_CODES;
+					break;
+				}
+			}
+		}
+	}
+
 	return 1;
 }
 
+/* Controls go through the terminal driver, so check that it won't mangle them. Tab stops are only trusted if terminfo lists them. */
+static void DetectMotionControls()
+{
+	struct termios State;
+	int Tabs;
+
+	Motion = TabWidth = 0;
+
+	if (tcgetattr(STDOUT_FILENO, &State) == -1)
+		State.c_oflag = 0;
+
+	if (!(State.c_oflag & OPOST))
+		Motion = MOTION_CR | MOTION_LF;
+	else {
+		if (!(State.c_oflag & (OCRNL | ONOCR)))
+			Motion |= MOTION_CR;
+		Motion |= MOTION_LF;
+		if (State.c_oflag & ONLCR)
+			Motion |= MOTION_LF_RETURNS;
+
+		/* Expanded tabs would overwrite cells. */
+		#if defined(TABDLY) && defined(TAB3)
+		if ((State.c_oflag & TABDLY) == TAB3)
+			return;
+		#elif defined(OXTABS)
+		if (State.c_oflag & OXTABS)
+			return;
+		#endif
+	}
+
+	Tabs = GetTermInfoInt(HINT_INT_INIT_TABS);
+	if (Tabs > 0)
+		TabWidth = Tabs;
+
+	return;
+}
+
 /* Put a Unicode character and check how far the cursor moves. Only reliable way to check. */
 int IsUnicodeSupported()
 {
@@ -321,10 +515,13 @@ int ColorsSupported()
 
 void HexSetTitle(const char *Title, const char *Icon)
 {
+	HexFlushWait();
+
 	if (Title)
-		printf(ESC "]2;%s" ESC "\\", Title);
+		OutputFormat(ESC "]2;%s" ESC "\\", Title);
 	if (Icon)
-		printf(ESC "]1;%s" ESC "\\", Icon);
+		OutputFormat(ESC "]1;%s" ESC "\\", Icon);
+	FlushOutput();
 
 	return;
 }
@@ -371,6 +568,7 @@ int InitSub(int Stage)
 			}
 
 			DetectQuirks();
+			DetectMotionControls();
 
 			break;
 
@@ -400,20 +598,24 @@ int InitSub(int Stage)
 		/* Final stage. Create a new screen. */
 		case 3:
 			Hint = GetTermInfoString(HINT_STR_ENTER_CA_MODE);
-			if (Hint)
-				printf("%s" ESC "[H", Hint);
-			else
-				fputs(ESC "c", stdout);
-
 			ExtendOutputBuffer();
+			BuildSGRTables();
+			BuildMoveTables();
+			SelectDrawRoutines();
+
+			if (Hint) {
+				OutputString(Hint);
+				OutputString(ESC "[H");
+			} else
+				OutputString(ESC "c");
 
 			Flags = ~(Flags & 0);
 			NewFlags = 0;
 			HexChangeFlags(&NewFlags);
 
-			OnRightEdge = 0;
+			Term->OnRightEdge = 0;
 
-			fflush(stdout);
+			FlushOutput();
 
 			break;
 
@@ -436,6 +638,8 @@ void FreeSub()
 	const char *Hint;
 	int NewFlags;
 
+	FreeAsync();
+
 	Flags = ~(Flags & 0);
 	NewFlags = 0;
 	HexChangeFlags(&NewFlags);
@@ -445,154 +649,316 @@ void FreeSub()
 
 	Hint = GetTermInfoString(HINT_STR_EXIT_CA_MODE);
 	if (Hint)
-		fputs(Hint, stdout);
+		OutputString(Hint);
 
 	if (!Hint || GetTermInfoBool(HINT_BOOL_CA_NOT_RESTORE))
-		fputs(ESC "c", stdout);
-
-	fflush(stdout);
+		OutputString(ESC "c");
 
+	FreeWorkers();
 	FreeInput();
+	FreeOutput();
+	FreeScrolling();
+	FreeDrawnRows();
 	FreeHints();
 
 	return;
 }
 
-/* Returns 1 if the bold attribute should be enabled. */
-static int GetColorCode(char *Output, unsigned int Color, int IsFG)
+/* Precomputed SGR parameters, so we don't need to format them on every change. */
+#define SGR_MAX_CODE	16
+typedef struct SGRCode {
+	unsigned char Size;
+	char Code[SGR_MAX_CODE - 1];
+} SGRCode;
+
+static SGRCode PaletteCodes[2][HEX_COL_OFFSET_TRUE];	/* BG, then FG. */
+static int TerminalColors;	/* What colors get brought down to, if at all. */
+static SGRCode ByteDigits[UCHAR_MAX + 1];
+
+/* HexColors belongs to the app, which may change it. It's only read from the app's side, before each flush. */
+int TerminalColorsChanged()
 {
-	int Code, NeedsBold = 0;
+	return GetTerminalColors() != TerminalColors;
+}
 
-	/* Standard colors. */
-	if (Color < HEX_COL_OFFSET_256) {
-		if (IsFG) {
-			if (Color <= 8) {
-				if (!Color)
-					/* These two quirk workarounds can still trigger a cursor change when it's not needed,
-					   but probably not worth the CPU usage fixing this correctly. */
-					Color = (Quirks & QUIRK_NO_DEFAULT_COLORS_CODES) ? 8 : 10;
-				Code = Color + 29;
-			} else {
-				Code = Color + 21;
-				NeedsBold = 1;
-			}
-		} else {
-			if (Color <= 8) {
-				if (!Color)
-					Color = (Quirks & QUIRK_NO_DEFAULT_COLORS_CODES) ? 1 : 10;
-				Code = Color + 39;
-			} else
-				Code = Color + 91;
+/* Returns 1 if they've changed, in which case what's on screen needs redrawing in them. */
+static int UpdateTerminalColors()
+{
+	if (!TerminalColorsChanged())
+		return 0;
+
+	TerminalColors = GetTerminalColors();
+	return 1;
+}
+
+/* Set, then unset. Rapid blink is skipped as we don't support it, neither do most terminals.
+   Xterm doesn't support the bold off code, instead makes it double underline. Instead, we'll unset faint which also unsets bold. */
+static const SGRCode AttributeCodes[2][HEX_MAX_ATTRIBUTES] = {
+	{ { 1, "1" }, { 1, "2" }, { 1, "3" }, { 1, "4" }, { 1, "5" }, { 1, "7" }, { 1, "8" }, { 1, "9" } },
+	{ { 2, "22" }, { 2, "22" }, { 2, "23" }, { 2, "24" }, { 2, "25" }, { 2, "27" }, { 2, "28" }, { 2, "29" } }
+};
+#define	ATTR_SHARED_UNSET	(HEX_ATTR_BOLD | HEX_ATTR_FAINT)
+
+static void SetSGRCode(SGRCode *S, const char *Prefix, int Number)
+{
+	S->Size = sprintf(S->Code, "%s%d", Prefix, Number);
+	return;
+}
+
+/* Bright foreground colors share the standard codes, with bold enabled. */
+static void BuildSGRTables()
+{
+	int I, IsFG, Code;
+
+	for (I = 0; I <= UCHAR_MAX; I++)
+		SetSGRCode(&ByteDigits[I], "", I);
+
+	for (IsFG = 0; IsFG < 2; IsFG++) {
+		for (I = 0; I < HEX_COL_OFFSET_256; I++) {
+			if (!I) {
+				if (Quirks & QUIRK_NO_DEFAULT_COLORS_CODES)
+					Code = IsFG ? 37 : 40;
+				else
+					Code = IsFG ? 39 : 49;
+			} else if (I <= 8)
+				Code = I + (IsFG ? 29 : 39);
+			else
+				Code = I + (IsFG ? 21 : 91);
+
+			SetSGRCode(&PaletteCodes[IsFG][I], "", Code);
 		}
 
-		sprintf(Output, "%d", Code);
+		for (; I < HEX_COL_OFFSET_TRUE; I++)
+			SetSGRCode(&PaletteCodes[IsFG][I], IsFG ? "38;5;" : "48;5;", I - HEX_COL_OFFSET_256);
 	}
-	/* 256-colors. */
-	else if (Color < HEX_COL_OFFSET_TRUE) {
-		Code = Color - HEX_COL_OFFSET_256;
-		sprintf(Output, "%c8;5;%d", IsFG ? '3' : '4', Code);
-	/* True color. */
-	} else {
-		int R, G, B;
 
-		Code = Color - HEX_COL_OFFSET_TRUE;
-		R = (Code >> 16) & ((1 << 8) - 1);
-		G = (Code >> 8) & ((1 << 8) - 1);
-		B = Code & ((1 << 8) - 1);
+	return;
+}
+
+static char *AppendSGRCode(char *Output, const SGRCode *S)
+{
+	memcpy(Output, S->Code, S->Size);
+	Output[S->Size] = ';';
+	return Output + S->Size + 1;
+}
+
+/* Current keeps the colors as given, with them only brought down to what the terminal has here. */
+static char *AppendColorCode(char *Output, unsigned int Color, int IsFG)
+{
+	Color = QuantizeColor(Color, TerminalColors);
+
+	if (Color < HEX_COL_OFFSET_TRUE)
+		return AppendSGRCode(Output, &PaletteCodes[IsFG][Color]);
 
-		sprintf(Output, "%c8;2;%d;%d;%d", IsFG ? '3' : '4', R, G, B);
+	Color -= HEX_COL_OFFSET_TRUE;
+	memcpy(Output, IsFG ? "38;2;" : "48;2;", 5);
+	Output = AppendSGRCode(Output + 5, &ByteDigits[(Color >> 16) & UCHAR_MAX]);
+	Output = AppendSGRCode(Output, &ByteDigits[(Color >> 8) & UCHAR_MAX]);
+	return AppendSGRCode(Output, &ByteDigits[Color & UCHAR_MAX]);
+}
+
+static char *AppendAttributeCodes(char *Output, unsigned int Attributes, int Unset)
+{
+	int I;
+
+	if (Unset && (Attributes & ATTR_SHARED_UNSET) == ATTR_SHARED_UNSET)
+		Attributes &= ~HEX_ATTR_BOLD;
+
+	for (I = 0; Attributes; I++, Attributes >>= 1) {
+		if (Attributes & 1)
+			Output = AppendSGRCode(Output, &AttributeCodes[Unset][I]);
 	}
 
-	return NeedsBold;
+	return Output;
 }
 
-static void GetAttributeCode(char *Output, unsigned int Attribute, int Unset)
+static unsigned int GetCursorAttributes(unsigned int FG, unsigned int Attributes)
 {
-	int Code;
+	if (FG > 8 && FG < HEX_COL_OFFSET_256)
+		Attributes |= HEX_ATTR_BOLD;
+	return Attributes;
+}
 
-	Code = ffs(Attribute);
-	if (Code > 5)	/* Skip rapid blink, which we don't support. Neither do most terminals. */
-		Code++;
+/* Adaptive color depth. While the link can't keep up, colors are sent at a lower depth. The reduced colors are kept
+   in Current, so they can be told apart & redrawn once it recovers. */
+#define	ADAPT_MAX_LAG_MS	100	/* How long what's queued may take to drain before reducing. */
+#define	ADAPT_RECOVER_FLUSHES	8	/* Flushes with nothing queued before going back to full. */
 
-	if (Unset)
-		Code += 20;
+static int AdaptiveColors, RecoverFlushes;	/* 0 for full depth. */
+static unsigned long DrainRate, LastWaited;	/* Bytes per second & milliseconds. */
+static size_t LastQueued, LastTotal;
+static struct timespec LastMeasure;
 
-	sprintf(Output, "%d", Code);
+/* Reduced on top of whatever the terminal itself needs. */
+static unsigned int ReduceColor(unsigned int Color)
+{
+	return QuantizeColor(Color, AdaptiveColors);
+}
+
+/* What the terminal will show once a cell is drawn. */
+static void ReduceChar(HexChar *C)
+{
+	if (AdaptiveColors) {
+		C->FG = ReduceColor(C->FG);
+		C->BG = ReduceColor(C->BG);
+	}
 	return;
 }
 
-/* Primary function to change output format style. Works out the difference between the current and requested cursor. */
-static int ChangeCursor(int FG, int BG, unsigned int Attributes)
+static void RestoreColorDepth()
 {
-	char EscapeString[64] = ESC "[", *Char = &EscapeString[2];
-	int I, Color, CurrentColor;
+	AdaptiveColors = 0;
+	RecoverFlushes = 0;
 
-	/* Colors first, so we can force bold if required. */
-	for (I = 0, CurrentColor = Current->FG, Color = FG; I < 2; I++, CurrentColor = Current->BG, Color = BG) {
-		if (Color == CurrentColor)
-			continue;
+	/* Anything drawn reduced will differ from the buffer. */
+	SetDamage(0, 0, Width, Height);
+
+	return;
+}
 
-		if (GetColorCode(Char, Color, !I))
-			Attributes |= HEX_ATTR_BOLD;
-		Char = strchr(Char, '\0');
-		*Char = ';';
-		Char++;
+/* Lagging is either having spent most of the time since the last measure waiting to write, or having more queued
+   than can drain in time. Whatever was written since then, less what's still queued, has reached the terminal. */
+static void AdaptColorDepth()
+{
+	struct timespec Now;
+	size_t Queued, Total, Drained;
+	unsigned long Waited;
+	long Elapsed;
+	int Lagging;
+
+	clock_gettime(CLOCK_MONOTONIC, &Now);
+	Queued = GetQueuedOutput();
+	Total = GetOutputTotal();
+	Waited = GetOutputWaited() - LastWaited;
+
+	Elapsed = (Now.tv_sec - LastMeasure.tv_sec) * 1000 + (Now.tv_nsec - LastMeasure.tv_nsec) / 1000000;
+	if (Elapsed <= 0)
+		return;
+
+	Lagging = 0;
+	if (LastMeasure.tv_sec || LastMeasure.tv_nsec) {
+		Drained = LastQueued + (Total - LastTotal);
+		Drained = Drained > Queued ? Drained - Queued : 0;
+		/* Smoothed, so a single slow frame won't swing it. */
+		DrainRate = (DrainRate * 3 + Drained * 1000 / Elapsed) / 4;
+
+		if (Waited * 2 > (unsigned long)Elapsed ||
+			(Queued && (!DrainRate || Queued * 1000 / DrainRate > ADAPT_MAX_LAG_MS)))
+			Lagging = 1;
 	}
 
-	/* Attributes. */
-	if (Attributes != Current->Attr) {
-		int Diff, A;
+	LastMeasure = Now;
+	LastQueued = Queued;
+	LastTotal = Total;
+	LastWaited += Waited;
+
+	if (Lagging) {
+		AdaptiveColors = AdaptiveColors ? 16 : 256;
+		RecoverFlushes = 0;
+	} else if (AdaptiveColors && !Queued && !Waited) {
+		if (++RecoverFlushes >= ADAPT_RECOVER_FLUSHES)
+			RestoreColorDepth();
+	} else
+		RecoverFlushes = 0;
+
+	return;
+}
 
-		Diff = Attributes ^ Current->Attr;
+/* Works out the difference between the style of T and the one requested, leaving T in the new style. Both the incremental
+   change & a full reset are considered, with the shortest being placed in Output. Returns its size, or 0 for no change. */
+#define	SGR_MAX_SIZE	(SGR_MAX_CODE * 8 + 2)
 
-		/* Xterm doesn't support the bold off code, instead makes it underline.
-		Instead, we'll unset faint & bold which shouldn't be together anyway. */
-		if (Diff & HEX_ATTR_BOLD && Current->Attr & HEX_ATTR_BOLD) {
-			Diff &= ~HEX_ATTR_BOLD;
-			Diff |= HEX_ATTR_FAINT;
-			Current->Attr |= HEX_ATTR_FAINT;
+static int BuildCursorChange(TermState *T, unsigned int FG, unsigned int BG, unsigned int Attributes, char *Output)
+{
+	char Incremental[SGR_MAX_SIZE] = ESC "[", Reset[SGR_MAX_SIZE] = ESC "[0;";
+	char *Char, *Best;
+	unsigned int Unset, Set;
+
+	FG = ReduceColor(FG);
+	BG = ReduceColor(BG);
+	/* Bright colors may need bold, once brought down. */
+	Attributes = GetCursorAttributes(QuantizeColor(FG, TerminalColors), Attributes);
+
+	Unset = T->Attr & ~Attributes;
+	Set = Attributes & ~T->Attr;
+	/* Unsetting either bold or faint will take the other with it. */
+	if (Unset & ATTR_SHARED_UNSET)
+		Set |= Attributes & ATTR_SHARED_UNSET;
+
+	Char = &Incremental[2];
+	if (FG != T->FG)
+		Char = AppendColorCode(Char, FG, 1);
+	if (BG != T->BG)
+		Char = AppendColorCode(Char, BG, 0);
+	Char = AppendAttributeCodes(Char, Unset, 1);
+	Char = AppendAttributeCodes(Char, Set, 0);
+	Best = Incremental;
+
+	/* A reset can only be shorter when something has to be turned off. */
+	if (Unset || ((!FG || !BG) && !(Quirks & QUIRK_NO_DEFAULT_COLORS_CODES))) {
+		char *ResetChar = &Reset[4];
+
+		if (FG || Quirks & QUIRK_NO_DEFAULT_COLORS_CODES)
+			ResetChar = AppendColorCode(ResetChar, FG, 1);
+		if (BG || Quirks & QUIRK_NO_DEFAULT_COLORS_CODES)
+			ResetChar = AppendColorCode(ResetChar, BG, 0);
+		ResetChar = AppendAttributeCodes(ResetChar, Attributes, 0);
+
+		if (ResetChar - Reset < Char - Incremental) {
+			Best = Reset;
+			Char = ResetChar;
 		}
+	}
 
-		A = 1;
-		for (I = 0; I < HEX_MAX_ATTRIBUTES; I++) {
+	/* Nothing to change. */
+	if (Char - Best <= 2)
+		return 0;
 
-			if (A & Diff) {
-				GetAttributeCode(Char, A, A & Current->Attr);
-				Char = strchr(Char, '\0');
-				*Char = ';';
-				Char++;
-			}
+	Char[-1] = 'm';	/* Replace the previous semicolon. */
+	memcpy(Output, Best, Char - Best);
 
-			A <<= 1;
-		}
+	T->FG = FG; T->BG = BG; T->Attr = Attributes;
 
-	}
+	return Char - Best;
+}
 
-	Char[-1] = 'm';	/* Replace the previous semicolon. */
-	Char[0] = '\0';
+/* Primary function to change output format style. */
+static int ChangeCursor(unsigned int FG, unsigned int BG, unsigned int Attributes)
+{
+	char Code[SGR_MAX_SIZE];
+	int Size;
 
-	fputs(EscapeString, stdout);
-	Current->FG = FG; Current->BG = BG; Current->Attr = Attributes;
+	Size = BuildCursorChange(Term, FG, BG, Attributes, Code);
+	if (!Size)
+		return 0;
+
+	OutputBytes(Code, Size);
 
 	return 1;
 }
 
-static int NeedsCursorChange(HexChar *Char)
+/* Compared as ChangeCursor() would leave them, once brought down. */
+static int NeedsCursorChange(const HexChar *Char)
 {
-	unsigned int FG, Attributes;
+	unsigned int FG = ReduceColor(Char->FG);
 
-	FG = Char->FG;
-	Attributes = Char->Attr;
+	if (FG != Term->FG ||
+		ReduceColor(Char->BG) != Term->BG ||
+		GetCursorAttributes(QuantizeColor(FG, TerminalColors), Char->Attr) != Term->Attr)
+		return 1;
 
-	if (FG >= 8 && FG < HEX_COL_OFFSET_256)
-		Attributes |= HEX_ATTR_BOLD;
+	return 0;
+}
 
-	if (FG != Current->FG ||
-		Char->BG != Current->BG ||
-		Attributes != Current->Attr)
+/* Terminals hold off drawing until the end, so the cursor can be left visible while it moves about. */
+static int UseSyncOutput()
+{
+	if (Flags & HEX_FLAG_OUTPUT_NO_SYNC)
+		return 0;
+	if (Flags & HEX_FLAG_OUTPUT_SYNC)
 		return 1;
 
-	return 0;
+	return Quirks & QUIRK_SYNC_OUTPUT;
 }
 
 /* A NewFlags of 0 will reset to the default terminal settings. */
@@ -603,6 +969,7 @@ int HexChangeFlags(int *NewFlags)
 	
 	if (!NewFlags)
 		return Flags;
+	HexFlushWait();
 
 	Diff = *NewFlags ^ Flags;
 	Flags = *NewFlags;
@@ -625,246 +992,1874 @@ int HexChangeFlags(int *NewFlags)
 	else if (Diff & HEX_FLAG_DISPLAY_BRIGHT_CURSOR && !(Flags & HEX_FLAG_DISPLAY_NO_CURSOR))
 		Hint = GetTermInfoString(HINT_STR_CURSOR_VISIBLE);
 	if (Hint)
-		fputs(Hint, stdout);
+		OutputString(Hint);
 
 	if (Diff & HEX_FLAG_DISPLAY_REVERSE_VIDEO)
 		/* I particularly dislike terminfo here, never exposing the individual codes for this feature.
 		   Rather it has them contained in a single 'flash' code which could also be a beep on some terminals. */
-		printf(ESC "[?5%c", (Flags & HEX_FLAG_DISPLAY_REVERSE_VIDEO) ? 'h' : 'l');
+		OutputFormat(ESC "[?5%c", (Flags & HEX_FLAG_DISPLAY_REVERSE_VIDEO) ? 'h' : 'l');
 
 	if (Diff & HEX_FLAG_EVENT_FOCUS)
-		printf(ESC "[?1004%c", (Flags & HEX_FLAG_EVENT_FOCUS) ? 'h' : 'l');
+		OutputFormat(ESC "[?1004%c", (Flags & HEX_FLAG_EVENT_FOCUS) ? 'h' : 'l');
 
+	FlushOutput();
 	return Flags;
 }
 
-static char *NS(char *Output, int Number)
+/* Cursor motion. Every candidate is costed in bytes, with the cheapest being sent. */
+#define MAX_CONTROL_REPEAT	8	/* Past this, an escape code will always be shorter. */
+#define	CSI_SIZE(N)	(3 + NumberSize(N))
+
+enum ColumnMoves {
+	COL_NONE,
+	COL_CUF,
+	COL_CUB,
+	COL_CHA,
+	COL_BS,
+	COL_TAB,
+	COL_CR,
+	COL_CR_CUF,
+	COL_CR_TAB
+};
+
+enum RowMoves {
+	ROW_NONE,
+	ROW_CUP,
+	ROW_CUD,
+	ROW_CUU,
+	ROW_CNL,
+	ROW_CPL,
+	ROW_LF,
+	ROW_LF_RETURNS,	/* The terminal driver adds a return. */
+	ROW_CR_LF
+};
+
+/* The moves beyond CUP, CUF, CUB, CUD & CUU that the terminal allows, in the order they're tried. Built once detection is
+   done, so planning doesn't check for them each time. */
+static unsigned char ColumnMoves[5], RowMoves[3];
+static int ColumnMoveCount, RowMoveCount, WrapFixCost;
+
+typedef struct ColumnMove {
+	int Kind;
+	int Tabs, Stop;
+	int Cost;
+} ColumnMove;
+
+typedef struct MovePlan {
+	int Row;
+	int From;
+	int Cost;
+	ColumnMove Column;
+} MovePlan;
+
+static int NumberSize(int N)
 {
-	if (Number == 1)
-		return "";
+	int Size;
 
-	sprintf(Output, "%d", Number);
-	return Output;
+	if (N == 1)	/* Parameters default to one. */
+		return 0;
+
+	for (Size = 1; N >= 10; Size++)
+		N /= 10;
+
+	return Size;
 }
 
-/* Primary cursor move function. Aims for the most efficient way possible, in output size. X & Y begin at zero, unlike ANSI. */
-static int MoveCursor(int X, int Y)
+static char *AppendDigits(char *Output, int N)
 {
-	char EscapeString[64] = ESC "[", *Char = &EscapeString[2];
-	char N[24], N2[24];
-	int CX = Current->X, CY = Current->Y, Change;
+	if (N <= UCHAR_MAX) {
+		memcpy(Output, ByteDigits[N].Code, ByteDigits[N].Size);
+		return Output + ByteDigits[N].Size;
+	}
 
-	/* CHA*, CUF & CUB */
-	if (Y == CY) {
-		if (X == CX)
-			return 0;
+	return Output + sprintf(Output, "%d", N);
+}
 
-		Change = X - CX;
-		if (Quirks & QUIRK_ABS_COL_CODE && abs(Change) != 1 && X < 8)
-			sprintf(Char, "%sG", NS(N, X + 1));
-		else
-			sprintf(Char, "%s%c", NS(N, abs(Change)), Change > 0 ? 'C' : 'D');
-	} else if (!(Y || X)) {
-		Char[0] = 'H';
-		Char[1] = '\0';
-	/* CNL & CPL */
-	} else if (!X && Quirks & QUIRK_LINE_CODES) {
-		Change = Y - CY;
-		sprintf(Char, "%s%c", NS(N, abs(Change)), Change > 0 ? 'E' : 'F');
-	/* CUU & CUD */
-	} else if (X == CX) {
-		if (OnRightEdge && Quirks & QUIRK_WRAPPING_FIX)
-			fputs(ESC "[D" ESC "[C", stdout);
-		Change = Y - CY;
-		sprintf(Char, "%s%c", NS(N, abs(Change)), Change > 0 ? 'B' : 'A');
-	/* CUP* */
-	} else
-		sprintf(Char, "%s;%sH", NS(N, Y + 1), NS(N2, X + 1));
+/* One is the default for most parameters, so can be left out. */
+static char *AppendNumber(char *Output, int N)
+{
+	if (N == 1)
+		return Output;
 
-	fputs(EscapeString, stdout);
-	OnRightEdge = 0;
-	Current->X = X; Current->Y = Y;
+	return AppendDigits(Output, N);
+}
 
-	return 1;
+static char *AppendCSI(char *Output, int N, char Final)
+{
+	*Output++ = '\x1B';
+	*Output++ = '[';
+	Output = AppendNumber(Output, N);
+	*Output++ = Final;
+
+	return Output;
 }
 
-static void UpdateOutputCursor()
+static char *AppendControls(char *Output, char Control, int Amount)
 {
-	Current->X++;
-	if (Current->X >= Width) {
-		if (!OnRightEdge) {
-			Current->X = Width - 1;
-			OnRightEdge = 1;
-			return;
-		}
-		OnRightEdge = 0;
+	memset(Output, Control, Amount);
+	return Output + Amount;
+}
+
+/* Returns the column reached, along with the amount of tabs needed to do so. */
+static int TabsTo(int From, int To, int *Tabs)
+{
+	int Next;
+
+	*Tabs = 0;
+	while (*Tabs < MAX_CONTROL_REPEAT) {
+		Next = (From / TabWidth + 1) * TabWidth;
+		if (Next >= Width)
+			Next = Width - 1;
+		if (Next > To || Next == From)
+			break;
 
-		Current->X = 1;
-		Current->Y++;
+		From = Next;
+		(*Tabs)++;
 	}
 
-	return;
+	return From;
 }
 
-static void Output(const char *CP)
+static void TryColumnMove(ColumnMove *Best, int Kind, int Cost, int Tabs, int Stop)
 {
-	if (*CP)
-		printf("%.*s", UTF8_MAX_BYTES, CP);
-	else
-		putchar(' ');
+	if (Cost < Best->Cost) {
+		Best->Kind = Kind;
+		Best->Cost = Cost;
+		Best->Tabs = Tabs;
+		Best->Stop = Stop;
+	}
+
 	return;
 }
 
-/* Core screen output function. */
-int HexFlush(int CurX, int CurY)
+/* Controls can't be trusted while the terminal has a pending wrap. */
+static int PlanColumnMove(int From, int To, int NoControls, ColumnMove *M)
 {
-	if (HasDamage) {
-		unsigned int I;
-		const size_t Total = Current->W * Current->H;
-		char *D = Damage;
-		HexChar *B = Current->Data, *BD = Buffer->Data;
-		unsigned int Cursor;
-		int X, Y, First = 1;
-
-		Cursor = GetOffset(Current->X, Current->Y, Width);
+	int Tabs, Stop, I;
 
-		for (I = 0; I < Total; I++) {
-			if (*D) {
-				*D = 0;
+	M->Kind = COL_NONE;
+	M->Cost = 0;
+	if (From == To)
+		return 0;
 
-				if (IsSameChar(&B[I], &BD[I])) {
-					D++;
-					continue;
+	M->Kind = To > From ? COL_CUF : COL_CUB;
+	M->Cost = CSI_SIZE(abs(To - From));
+
+	for (I = 0; I < ColumnMoveCount; I++) {
+		switch (ColumnMoves[I]) {
+			case COL_CHA:
+				TryColumnMove(M, COL_CHA, CSI_SIZE(To + 1), 0, 0);
+				break;
+			case COL_BS:
+				if (To < From && !NoControls && From - To <= MAX_CONTROL_REPEAT)
+					TryColumnMove(M, COL_BS, From - To, 0, 0);
+				break;
+			case COL_CR:
+				if (!To)
+					TryColumnMove(M, COL_CR, 1, 0, 0);
+				else
+					TryColumnMove(M, COL_CR_CUF, 1 + CSI_SIZE(To), 0, 0);
+				break;
+			case COL_TAB:
+				if (To > From && !NoControls) {
+					Stop = TabsTo(From, To, &Tabs);
+					if (Tabs)
+						TryColumnMove(M, COL_TAB, Tabs + (Stop < To ? CSI_SIZE(To - Stop) : 0), Tabs, Stop);
 				}
-
-				if (Cursor != I) {
-					X = I % Width;
-					Y = I / Width;
-					MoveCursor(X, Y);
-				} else if (First && OnRightEdge) {
-					/* If on edge, we'll need to send a NOOP move code in order for the cursor to remain in place. */
-					if (Quirks & QUIRK_WRAPPING_FIX)
-						fputs(ESC "[D", stdout);
-					fputs(ESC "[C", stdout);
-					OnRightEdge = 0;
+				break;
+			case COL_CR_TAB:
+				if (To) {
+					Stop = TabsTo(0, To, &Tabs);
+					if (Tabs)
+						TryColumnMove(M, COL_CR_TAB, 1 + Tabs + (Stop < To ? CSI_SIZE(To - Stop) : 0), Tabs, Stop);
 				}
-				First = 0;
-
-				if (NeedsCursorChange(&BD[I]))
-					ChangeCursor(BD[I].FG, BD[I].BG, BD[I].Attr);
-
-				B[I] = BD[I];
-				Output(BD[I].CP);
-				UpdateOutputCursor();
-				Cursor = I + 1;
-			}
-			D++;
+				break;
 		}
+	}
+
+	return M->Cost;
+}
 
-		HasDamage = 0;
+static char *AppendColumnMove(char *Output, const ColumnMove *M, int From, int To)
+{
+	switch (M->Kind) {
+		case COL_CUF:
+			return AppendCSI(Output, To - From, 'C');
+		case COL_CUB:
+			return AppendCSI(Output, From - To, 'D');
+		case COL_CHA:
+			return AppendCSI(Output, To + 1, 'G');
+		case COL_BS:
+			return AppendControls(Output, '\b', From - To);
+		case COL_CR:
+			return AppendControls(Output, '\r', 1);
+		case COL_CR_CUF:
+			Output = AppendControls(Output, '\r', 1);
+			return AppendCSI(Output, To, 'C');
+		case COL_CR_TAB:
+			Output = AppendControls(Output, '\r', 1);
+		case COL_TAB:
+			Output = AppendControls(Output, '\t', M->Tabs);
+			if (M->Stop < To)
+				Output = AppendCSI(Output, To - M->Stop, 'C');
+			break;
 	}
 
-	if (CurX >= 0) {
-		HexClipCursor(&CurX, &CurY);
-		MoveCursor(CurX, CurY);
+	return Output;
+}
+
+static void TryRowMove(MovePlan *Best, int Row, int Cost, int From, int To, int NoControls)
+{
+	ColumnMove Column;
+
+	Cost += PlanColumnMove(From, To, NoControls, &Column);
+	if (Cost < Best->Cost) {
+		Best->Row = Row;
+		Best->Cost = Cost;
+		Best->From = From;
+		Best->Column = Column;
 	}
 
-	fflush(stdout);
-	return 1;
+	return;
 }
 
-/* Full redraw. Should be called after a resize or restore event. */
-int HexFullFlush(int UseBuffer, int CurX, int CurY)
+/* Works out the cheapest way to move the cursor, returning its size in bytes. */
+static int PlanCursorMove(int X, int Y, MovePlan *Best)
 {
-	unsigned int I;
-	const size_t Total = Current->W * Current->H;
-	HexChar *BD, *C;
+	int CX = Term->X, CY = Term->Y, Change, Fix, I;
 
-	BD = UseBuffer ? Buffer->Data : Current->Data;
-	C = BD;
+	Best->Row = ROW_NONE;
+	Best->From = CX;
+	Best->Column.Kind = COL_NONE;
+	Best->Cost = 0;
+	if (X == CX && Y == CY)
+		return 0;
 
-	/* We can't be certain where the cursor is, so we'll just reset. */
-	fputs(ESC "[H", stdout);
+	/* CUP. Always available. */
+	Best->Row = ROW_CUP;
+	Best->Cost = 3 + NumberSize(Y + 1) + (X ? 1 + NumberSize(X + 1) : 0);
+	if (CY < 0)
+		return Best->Cost;
+
+	Change = Y - CY;
+	if (!Change)
+		TryRowMove(Best, ROW_NONE, 0, CX, X, Term->OnRightEdge);
+	else {
+		/* CUU & CUD. The wrapping fix is needed as these won't clear OnRightEdge on some terminals. */
+		Fix = Term->OnRightEdge ? WrapFixCost : 0;
+		TryRowMove(Best, Change > 0 ? ROW_CUD : ROW_CUU, Fix + CSI_SIZE(abs(Change)), CX, X, Term->OnRightEdge);
+
+		for (I = 0; I < RowMoveCount; I++) {
+			switch (RowMoves[I]) {
+				case ROW_CNL:
+					TryRowMove(Best, Change > 0 ? ROW_CNL : ROW_CPL, CSI_SIZE(abs(Change)), 0, X, 0);
+					break;
+				case ROW_LF:
+					if (Change > 0 && Change <= MAX_CONTROL_REPEAT && !Term->OnRightEdge)
+						TryRowMove(Best, ROW_LF, Change, CX, X, 0);
+					break;
+				case ROW_LF_RETURNS:
+					if (Change > 0 && Change <= MAX_CONTROL_REPEAT)
+						TryRowMove(Best, ROW_LF_RETURNS, Change, 0, X, 0);
+					break;
+				case ROW_CR_LF:
+					if (Change > 0 && Change <= MAX_CONTROL_REPEAT)
+						TryRowMove(Best, ROW_CR_LF, 1 + Change, 0, X, 0);
+					break;
+			}
+		}
+	}
 
-	for (I = 0; I < Total; I++) {
-		if (NeedsCursorChange(C))
-			ChangeCursor(C->FG, C->BG, C->Attr);
-		Output(C->CP);
-		C++;
+	return Best->Cost;
+}
+
+static void BuildMoveTables()
+{
+	ColumnMoveCount = RowMoveCount = 0;
+
+	if (Quirks & QUIRK_ABS_COL_CODE)
+		ColumnMoves[ColumnMoveCount++] = COL_CHA;
+	ColumnMoves[ColumnMoveCount++] = COL_BS;
+	if (Motion & MOTION_CR)
+		ColumnMoves[ColumnMoveCount++] = COL_CR;
+	if (TabWidth) {
+		ColumnMoves[ColumnMoveCount++] = COL_TAB;
+		if (Motion & MOTION_CR)
+			ColumnMoves[ColumnMoveCount++] = COL_CR_TAB;
 	}
 
-	if (UseBuffer) {
-		memcpy(Current->Data, BD, Total * sizeof(HexChar));
-		memset(Damage, 0, Total);
-		HasDamage = 0;
+	if (Quirks & QUIRK_LINE_CODES)
+		RowMoves[RowMoveCount++] = ROW_CNL;
+	if (Motion & MOTION_LF) {
+		if (Motion & MOTION_LF_RETURNS)
+			RowMoves[RowMoveCount++] = ROW_LF_RETURNS;
+		else {
+			RowMoves[RowMoveCount++] = ROW_LF;
+			if (Motion & MOTION_CR)
+				RowMoves[RowMoveCount++] = ROW_CR_LF;
+		}
 	}
 
-	Current->X = Current->W - 1;
-	Current->Y = Current->H - 1;
+	/* Moving back & forth a column, so CUU & CUD will clear OnRightEdge. */
+	WrapFixCost = Quirks & QUIRK_WRAPPING_FIX ? 6 : 0;
 
-	if (CurX >= 0) {
-		HexClipCursor(&CurX, &CurY);
-		MoveCursor(CurX, CurY);
+	return;
+}
+
+/* Primary cursor move function. Aims for the most efficient way possible, in output size. X & Y begin at zero, unlike ANSI. */
+static int MoveCursor(int X, int Y)
+{
+	char EscapeString[64], *Char = EscapeString;
+	int Change;
+	MovePlan Best;
+
+	if (!PlanCursorMove(X, Y, &Best))
+		return 0;
+
+	Change = Y - Term->Y;
+	switch (Best.Row) {
+		case ROW_CUP:
+			*Char++ = '\x1B';
+			*Char++ = '[';
+			Char = AppendNumber(Char, Y + 1);
+			if (X) {
+				*Char++ = ';';
+				Char = AppendNumber(Char, X + 1);
+			}
+			*Char++ = 'H';
+			break;
+		case ROW_CUD:
+		case ROW_CUU:
+			if (Term->OnRightEdge && WrapFixCost)
+				Char = AppendCSI(AppendCSI(Char, 1, 'D'), 1, 'C');
+			Char = AppendCSI(Char, abs(Change), Best.Row == ROW_CUD ? 'B' : 'A');
+			break;
+		case ROW_CNL:
+		case ROW_CPL:
+			Char = AppendCSI(Char, abs(Change), Best.Row == ROW_CNL ? 'E' : 'F');
+			break;
+		case ROW_CR_LF:
+			Char = AppendControls(Char, '\r', 1);
+		case ROW_LF:
+		case ROW_LF_RETURNS:
+			Char = AppendControls(Char, '\n', Change);
+			break;
 	}
+	if (Best.Row != ROW_CUP)
+		Char = AppendColumnMove(Char, &Best.Column, Best.From, X);
+
+	OutputBytes(EscapeString, Char - EscapeString);
+	Term->OnRightEdge = 0;
+	Term->X = X; Term->Y = Y;
 
-	fflush(stdout);
 	return 1;
 }
 
-/* We'll simply disable the buffer for now. Seems to cause problems on heavy flushes, even with large buffers. */
-int ExtendOutputBuffer()
+static void UpdateOutputCursor()
 {
-	if (setvbuf(stdout, NULL, _IONBF, 0))
-		return 0;
-	return 1;
+	Term->X++;
+	if (Term->X >= Width) {
+		if (!Term->OnRightEdge) {
+			Term->X = Width - 1;
+			Term->OnRightEdge = 1;
+			return;
+		}
+		Term->OnRightEdge = 0;
+
+		Term->X = 1;
+		Term->Y++;
+	}
+
+	return;
 }
 
-/* Doesn't seem that we can rely on the terminal being in any state, so we'll reset all. */
-int ContinueHandler()
+static size_t GetCellSize(const char *CP)
 {
-	struct sigaction NewHandler;
-	int PreviousFlags;
-	const char *Hint;
+	size_t Size;
 
-	/* As we have no way of knowing if the terminal has been resized during the down time, we'll force one. */
-	GotResizeSignal = 0;
-	if (!ResizeBuffers())
-		return 0;
-	ExtendOutputBuffer();
+	GetCellBytes(CP, &Size);
 
-	memset(&NewHandler, 0, sizeof(NewHandler));
-	NewHandler.sa_handler = ContinueEvent;
-	sigemptyset(&NewHandler.sa_mask);
-	if (sigaction(SIGCONT, &NewHandler, NULL) == -1)
-		return 0;
-	NewHandler.sa_handler = ResizeEvent;
-	if (sigaction(SIGWINCH, &NewHandler, NULL) == -1)
-		return 0;
+	return Size;
+}
 
-	ChangeCursor(0, 0, 0);
+/* The bytes needed to draw Char, along with changing to its style from that of T, which is left in it. */
+static int GetDrawCost(TermState *T, const HexChar *Char)
+{
+	char Code[SGR_MAX_SIZE];
 
-	Hint = GetTermInfoString(HINT_STR_ENTER_CA_MODE);
-	if (Hint)
-		fputs(Hint, stdout);
+	return BuildCursorChange(T, Char->FG, Char->BG, Char->Attr, Code) + (*Char->CP ? GetCellSize(Char->CP) : 1);
+}
 
-	PreviousFlags = Flags;
-	Flags = ~Flags;
-	HexChangeFlags(&PreviousFlags);
-	
-	if (!ContinueInputHandler())
-		return 0;
+/* Likewise, for the cells of B which differ from A, drawn in order. */
+static int GetRedrawCost(TermState *T, const HexChar *A, const HexChar *B, unsigned int Count)
+{
+	unsigned int I;
+	int Cost = 0;
 
-	return 1;
+	for (I = 0; I < Count; I++) {
+		if (!IsSameChar(&A[I], &B[I]))
+			Cost += GetDrawCost(T, &B[I]);
+	}
+
+	return Cost;
 }
 
-/* No reliable way to ensure that the terminal resized, even to what the user wanted, so return the size as well. */
-int HexResize(int *W, int *H)
+static void Output(const char *CP)
 {
-	struct winsize Size;
-	int Return;
+	const char *Bytes;
+	size_t Size;
 
-	printf(ESC "[8;%d;%dt", *H, *W);
-	fflush(stdout);
+	if (!*CP) {
+		OutputBytes(" ", 1);
+		return;
+	}
+
+	Bytes = GetCellBytes(CP, &Size);
+	OutputBytes(Bytes, Size);
+
+	return;
+}
+
+/* Wide characters are drawn whole, from the cell on the left. Either half on its own is shown as a space, as is anything
+   that doesn't take up a column, so the cursor can always be tracked. Without Unicode, the byte is just a character. */
+#define	IsTail(C)	(Unicode && (C)->CP[0] == *HEX_WIDE_TAIL && !(C)->CP[1])
+
+enum CellKinds {
+	CELL_NARROW,
+	CELL_WIDE,
+	CELL_TAIL,
+	CELL_SPACE
+};
+
+static int GetCellKind(const HexChar *B, unsigned int I)
+{
+	const HexChar *C = &B[I];
+
+	if (!(C->CP[0] & 0x80))
+		return CELL_NARROW;
+
+	if (IsTail(C))
+		return I % Width && GetCellWidth(C[-1].CP) == 2 ? CELL_TAIL : CELL_SPACE;
+
+	switch (GetCellWidth(C->CP)) {
+		case 1:
+			return CELL_NARROW;
+		case 2:
+			if (I % Width < Width - 1 && IsTail(&C[1]))
+				return CELL_WIDE;
+	}
+
+	return CELL_SPACE;
+}
+
+/* Reprints the unchanged cells leading up to the next change, if that's cheaper than moving over them.
+   They're taken from Current, so only those already in the current style are considered. */
+#define	MAX_BRIDGE_CELLS	16
+
+static int BridgeGap(unsigned int From, unsigned int To)
+{
+	HexChar *C = Current->Data;
+	unsigned int I;
+	int Cost, MoveCost;
+	MovePlan Plan;
+
+	if (From > To || To - From > MAX_BRIDGE_CELLS)
+		return 0;
+
+	MoveCost = PlanCursorMove(To % Width, To / Width, &Plan);
+
+	Cost = 0;
+	for (I = From; I < To; I++) {
+		if (NeedsCursorChange(&C[I]) || GetCellKind(C, I) != CELL_NARROW)
+			return 0;
+
+		Cost += GetCellSize(C[I].CP);
+		if (Cost >= MoveCost)
+			return 0;
+	}
+
+	for (I = From; I < To; I++) {
+		Output(C[I].CP);
+		UpdateOutputCursor();
+	}
+
+	return 1;
+}
+
+/* Blank cells which would look the same after being erased. */
+#define	ATTR_VISIBLE_ON_BLANK	(HEX_ATTR_UNDERLINE | HEX_ATTR_INVERSE | HEX_ATTR_CROSSED)
+
+static int IsBlank(const HexChar *C)
+{
+	if (C->CP[0] && (C->CP[0] != ' ' || C->CP[1]))
+		return 0;
+
+	return !(C->Attr & ATTR_VISIBLE_ON_BLANK);
+}
+
+/* Erased cells only take on the current background with bce. */
+static int CanEraseWith(unsigned int BG)
+{
+	if (Quirks & QUIRK_BACK_COLOR_ERASE)
+		return 1;
+
+	return !BG && !(Quirks & QUIRK_NO_DEFAULT_COLORS_CODES);
+}
+
+/* Bce is known to be set when true, so the check can be skipped. */
+static ALWAYS_INLINE int IsErasable(const HexChar *C, int Bce)
+{
+	return IsBlank(C) && C->BG == Term->BG && (Bce || CanEraseWith(C->BG));
+}
+
+enum RunOutputs {
+	RUN_PRINT,
+	RUN_REP,
+	RUN_ECH,
+	RUN_EL
+};
+
+/* Outputs the cell at I along with any identical ones following it on the row, using REP, ECH or EL when they're shorter.
+   The cursor & style should already be in place. Returns the amount of cells covered, with Cursor updated to where it was left.
+   Rep, Ech & Bce are the quirks, passed in so the variants below can have them as constants. */
+static ALWAYS_INLINE unsigned int OutputRunWith(const HexChar *BD, unsigned int I, int Full, unsigned int *Cursor, int Rep, int Ech, int Bce)
+{
+	HexChar *B = Current->Data;
+	char EscapeString[16];
+	const char *CP = BD[I].CP;
+	unsigned int RowEnd, J, Last, Run, Covered;
+	int Size, Cost, Best, Kind;
+
+	switch (GetCellKind(BD, I)) {
+		case CELL_WIDE:
+			Output(CP);
+			UpdateOutputCursor();
+			UpdateOutputCursor();
+			*Cursor = I + 2;
+
+			for (J = I; J < I + 2; J++) {
+				B[J] = BD[J];
+				ReduceChar(&B[J]);
+				if (!Full)
+					Damage[J] = 0;
+			}
+			return 2;
+		case CELL_NARROW:
+			break;
+		default:
+			CP = " ";
+			break;
+	}
+
+	/* Unless we're redrawing everything, there's no need to cover unchanged cells at the end of the run. */
+	RowEnd = I - I % Width + Width;
+	Last = I;
+	for (J = I + 1; CP == BD[I].CP && J < RowEnd && IsSameChar(&BD[J], &BD[I]); J++) {
+		if (Full || !IsSameChar(&B[J], &BD[J]))
+			Last = J;
+	}
+	Run = Last - I + 1;
+
+	Size = *CP ? GetCellSize(CP) : 1;
+	Kind = RUN_PRINT;
+	Best = Run * Size;
+	Covered = Run;
+
+	/* Repeating a cluster would only repeat its last character. */
+	if (Run > 1 && Rep && !IsCluster(CP)) {
+		Cost = Size + CSI_SIZE(Run - 1);
+		if (Cost < Best) {
+			Kind = RUN_REP;
+			Best = Cost;
+		}
+	}
+
+	/* Erasing leaves the cursor in place. Not possible on the edge, as the cursor isn't where the next cell goes. */
+	if (!Term->OnRightEdge && IsErasable(&BD[I], Bce)) {
+		if (Ech) {
+			Cost = CSI_SIZE(Run) * 2;	/* Allow for moving past it afterwards. */
+			if (Cost < Best) {
+				Kind = RUN_ECH;
+				Best = Cost;
+			}
+		}
+
+		for (J = I + 1; J < RowEnd && IsErasable(&BD[J], Bce); J++);
+		if (J == RowEnd && 3 < Best) {
+			Kind = RUN_EL;
+			Covered = RowEnd - I;
+		}
+	}
+
+	switch (Kind) {
+		case RUN_PRINT:
+			for (J = 0; J < Run; J++)
+				Output(CP);
+			break;
+		case RUN_REP:
+			Output(CP);
+			OutputBytes(EscapeString, AppendCSI(EscapeString, Run - 1, 'b') - EscapeString);
+			break;
+		case RUN_ECH:
+			OutputBytes(EscapeString, AppendCSI(EscapeString, Run, 'X') - EscapeString);
+			break;
+		case RUN_EL:
+			OutputString(ESC "[K");
+			break;
+	}
+
+	if (Kind == RUN_PRINT || Kind == RUN_REP) {
+		for (J = 0; J < Run; J++)
+			UpdateOutputCursor();
+		*Cursor = I + Run;
+	} else
+		*Cursor = I;
+
+	for (J = I; J < I + Covered; J++) {
+		B[J] = BD[J];
+		ReduceChar(&B[J]);
+		if (!Full)
+			Damage[J] = 0;
+	}
+
+	return Covered;
+}
+
+static unsigned int OutputRun(const HexChar *BD, unsigned int I, int Full, unsigned int *Cursor)
+{
+	return OutputRunWith(BD, I, Full, Cursor, Quirks & QUIRK_REP_CODE, Quirks & QUIRK_ECH_CODE, Quirks & QUIRK_BACK_COLOR_ERASE);
+}
+
+/* When most of the screen is changing to a single blank cell, it's cheaper to clear it all & only draw what remains.
+   Current is updated to match, with damage set for everything that now needs drawing. */
+static int ClearScreenPass()
+{
+	unsigned int I, Damaged, Changed, Blanks, Votes;
+	const unsigned int Total = Current->W * Current->H;
+	int Y;
+	HexChar *B = Current->Data, *BD = Buffer->Data;
+	const HexChar *Dominant;
+
+	/* The spans give an upper bound. */
+	Damaged = 0;
+	for (Y = NextDamagedRow(0); Y < Height; Y = NextDamagedRow(Y + 1))
+		Damaged += DamageSpans[Y * 2 + 1] - DamageSpans[Y * 2];
+	if (Damaged < Total / 2)
+		return 0;
+
+	/* Only damaged cells can be changing, so the vote for the background of blank cells is taken over those. */
+	Dominant = NULL;
+	Votes = Changed = 0;
+	for (Y = NextDamagedRow(0); Y < Height; Y = NextDamagedRow(Y + 1)) {
+		for (I = Y * Width + DamageSpans[Y * 2]; I < Y * Width + DamageSpans[Y * 2 + 1]; I++) {
+			if (!Damage[I] || IsSameChar(&B[I], &BD[I]))
+				continue;
+			Changed++;
+
+			if (!IsBlank(&BD[I]))
+				continue;
+			if (!Votes) {
+				Dominant = &BD[I];
+				Votes = 1;
+			} else if (BD[I].BG == Dominant->BG)
+				Votes++;
+			else
+				Votes--;
+		}
+	}
+	if (!Dominant || Changed < Total / 2 || !CanEraseWith(Dominant->BG))
+		return 0;
+
+	/* Everything left after the clear gets drawn, so give up once that's no cheaper. */
+	Blanks = 0;
+	for (I = 0; I < Total && I - Blanks < Changed; I++) {
+		if (IsBlank(&BD[I]) && BD[I].BG == Dominant->BG)
+			Blanks++;
+	}
+	if (Blanks < Total / 2 || Total - Blanks >= Changed)
+		return 0;
+
+	if (NeedsCursorChange(Dominant))
+		ChangeCursor(Dominant->FG, Dominant->BG, Dominant->Attr);
+	OutputString(ESC "[2J");
+
+	for (I = 0; I < Total; I++) {
+		if (IsBlank(&BD[I]) && BD[I].BG == Dominant->BG) {
+			B[I] = BD[I];
+			Damage[I] = 0;
+		} else {
+			B[I] = *Dominant;
+			Damage[I] = 1;
+		}
+		ReduceChar(&B[I]);
+	}
+	MarkDamage(0, 0, Width, Height);
+
+	return 1;
+}
+
+/* Without bce, terminals vary on whether cells blanked by scrolling or shifting use the current color, so make it the default. */
+static void SetBlankColor()
+{
+	if (!(Quirks & QUIRK_BACK_COLOR_ERASE))
+		ChangeCursor(Term->FG, 0, Term->Attr);
+	return;
+}
+
+/* What the terminal will fill those cells with. */
+static HexChar GetBlankChar()
+{
+	HexChar Blank;
+
+	memset(&Blank, 0, sizeof(Blank));
+	if (Quirks & QUIRK_BACK_COLOR_ERASE)
+		Blank.BG = Term->BG;
+
+	return Blank;
+}
+
+/* The default color can't be set without a code. */
+static int CanBlankCells()
+{
+	return !(Quirks & QUIRK_NO_DEFAULT_COLORS_CODES) || Quirks & QUIRK_BACK_COLOR_ERASE;
+}
+
+/* Rectangular areas. Fills & copies made to the terminal buffer are recorded, so they can be repeated on the terminal
+   with DECFRA, DECERA & DECCRA, rather than each cell being sent. */
+#define	MAX_RECORDED_OPS	16
+#define	RECT_STYLE_COST		8	/* Rough guess for when the fill needs a style change. */
+#define	DRAW_ALL		(HEX_DRAW_CP | HEX_DRAW_FG | HEX_DRAW_BG | HEX_DRAW_ATTR)
+
+enum RectOps {
+	RECT_FILL,
+	RECT_COPY
+};
+
+typedef struct RectOp {
+	int Type;
+	int X, Y, W, H;
+	int SX, SY;
+	HexChar Char;
+} RectOp;
+
+static RectOp Recorded[MAX_RECORDED_OPS];
+static int RecordedOps;
+
+/* Only plain ASCII can be given to DECFRA. Nothing's recorded while flushing in the background, as the flush has the
+   list to itself. */
+void RecordFill(int X, int Y, int W, int H, const HexChar *Char, unsigned int Flags)
+{
+	RectOp *R;
+
+	if (!(Quirks & QUIRK_RECT_CODES) || Buffer != Terminal || RecordedOps >= MAX_RECORDED_OPS || W <= 0 || H <= 0 ||
+		(Flags & DRAW_ALL) != DRAW_ALL ||
+		(Char->CP[0] && (Char->CP[0] < ' ' || Char->CP[0] > '~' || Char->CP[1])))
+		return;
+
+	R = &Recorded[RecordedOps++];
+	R->Type = RECT_FILL;
+	R->X = X; R->Y = Y; R->W = W; R->H = H;
+	R->Char = *Char;
+	R->Char.CP[1] = '\0';
+
+	return;
+}
+
+void RecordCopy(int SX, int SY, int X, int Y, int W, int H, unsigned int Flags)
+{
+	RectOp *R;
+
+	if (!(Quirks & QUIRK_RECT_CODES) || Buffer != Terminal || RecordedOps >= MAX_RECORDED_OPS || W <= 0 || H <= 0 ||
+		(Flags & DRAW_ALL) != DRAW_ALL || Flags & HEX_DRAW_TRANSPARENT ||
+		(SX == X && SY == Y))
+		return;
+
+	R = &Recorded[RecordedOps++];
+	R->Type = RECT_COPY;
+	R->X = X; R->Y = Y; R->W = W; R->H = H;
+	R->SX = SX; R->SY = SY;
+
+	return;
+}
+
+static int IsErasedChar(const HexChar *C)
+{
+	return !C->FG && !C->BG && !C->Attr && (!C->CP[0] || C->CP[0] == ' ') && !(Quirks & QUIRK_NO_DEFAULT_COLORS_CODES);
+}
+
+/* Cells made correct, minus the correct ones which would be overwritten. */
+static int GetRectGain(const RectOp *R)
+{
+	const HexChar *New, *B = Current->Data, *BD = Buffer->Data;
+	int X, Y, I, Gain = 0;
+
+	for (Y = 0; Y < R->H; Y++) {
+		I = (R->Y + Y) * Width + R->X;
+
+		for (X = 0; X < R->W; X++, I++) {
+			if (R->Type == RECT_FILL)
+				New = &R->Char;
+			else
+				New = &B[(R->SY + Y) * Width + R->SX + X];
+
+			if (IsSameChar(New, &BD[I]))
+				Gain += !IsSameChar(&B[I], &BD[I]);
+			else
+				Gain -= IsSameChar(&B[I], &BD[I]);
+		}
+	}
+
+	return Gain;
+}
+
+static void ApplyRect(const RectOp *R)
+{
+	HexChar *B = Current->Data, Fill;
+	int Y, Step;
+
+	if (R->Type == RECT_FILL) {
+		Fill = R->Char;
+		ReduceChar(&Fill);
+
+		for (Y = 0; Y < R->H; Y++) {
+			int X;
+
+			for (X = 0; X < R->W; X++)
+				B[(R->Y + Y) * Width + R->X + X] = Fill;
+		}
+	} else {
+		/* Work away from the destination, so overlapping rows aren't copied twice. */
+		Y = R->Y > R->SY ? R->H - 1 : 0;
+		Step = R->Y > R->SY ? -1 : 1;
+
+		for (; Y >= 0 && Y < R->H; Y += Step)
+			memmove(&B[(R->Y + Y) * Width + R->X], &B[(R->SY + Y) * Width + R->SX], R->W * sizeof(HexChar));
+	}
+
+	SetDamage(R->X, R->Y, R->W, R->H);
+
+	return;
+}
+
+/* Rectangles are given as top;left;bottom;right. The bottom & right default to the edge of the screen. */
+static char *AppendRect(char *Output, int X, int Y, int W, int H)
+{
+	Output = AppendNumber(Output, Y + 1);
+	*Output++ = ';';
+	Output = AppendNumber(Output, X + 1);
+	*Output++ = ';';
+	if (Y + H != Height)
+		Output = AppendDigits(Output, Y + H);
+	*Output++ = ';';
+	if (X + W != Width)
+		Output = AppendDigits(Output, X + W);
+
+	return Output;
+}
+
+static int RectPass()
+{
+	char EscapeString[64], *Char;
+	const RectOp *R;
+	int I, Cost, Erase, Sent = 0;
+
+	for (I = 0; I < RecordedOps; I++) {
+		R = &Recorded[I];
+
+		/* Could have been recorded before a resize. */
+		if (R->X + R->W > Width || R->Y + R->H > Height ||
+			(R->Type == RECT_COPY && (R->SX + R->W > Width || R->SY + R->H > Height)))
+			continue;
+
+		if (CrossesWide(R->X, R->Y, R->W, R->H) || (R->Type == RECT_COPY && CrossesWide(R->SX, R->SY, R->W, R->H)))
+			continue;
+
+		Char = EscapeString;
+		*Char++ = '\x1B';
+		*Char++ = '[';
+		Erase = 0;
+
+		if (R->Type == RECT_FILL) {
+			Erase = IsErasedChar(&R->Char);
+			if (!Erase) {
+				Char = AppendDigits(Char, R->Char.CP[0] ? R->Char.CP[0] : ' ');
+				*Char++ = ';';
+			}
+			Char = AppendRect(Char, R->X, R->Y, R->W, R->H);
+			*Char++ = '$';
+			*Char++ = Erase ? 'z' : 'x';
+		} else {
+			Char = AppendRect(Char, R->SX, R->SY, R->W, R->H);
+			*Char++ = ';';
+			*Char++ = ';';
+			Char = AppendNumber(Char, R->Y + 1);
+			*Char++ = ';';
+			Char = AppendNumber(Char, R->X + 1);
+			*Char++ = '$';
+			*Char++ = 'v';
+		}
+
+		Cost = Char - EscapeString;
+		if (R->Type == RECT_FILL && !Erase && NeedsCursorChange(&R->Char))
+			Cost += RECT_STYLE_COST;
+		if (GetRectGain(R) <= Cost)
+			continue;
+
+		/* DECFRA uses the current style. Erasing may as well, depending on the terminal. */
+		if (Erase)
+			ChangeCursor(Term->FG, 0, Term->Attr & ~ATTR_VISIBLE_ON_BLANK);
+		else if (R->Type == RECT_FILL)
+			ChangeCursor(R->Char.FG, R->Char.BG, R->Char.Attr);
+
+		OutputBytes(EscapeString, Char - EscapeString);
+		ApplyRect(R);
+		Sent++;
+	}
+
+	RecordedOps = 0;
+
+	return Sent;
+}
+
+/* Drawn rows. A row left without damage matches Buffer, so shares its hash. While that's unchanged at the next flush,
+   the row can be passed over without comparing any cells. */
+static unsigned long long *DrawnHashes;
+static char *DrawnRows;
+static int DrawnWidth, DrawnHeight;
+
+static int IsDrawnRow(int Y)
+{
+	return DrawnWidth == Width && DrawnHeight == Height && DrawnRows[Y];
+}
+
+static void SkipDrawnRows()
+{
+	int Y, Remaining = 0;
+
+	for (Y = NextDamagedRow(0); Y < Height; Y = NextDamagedRow(Y + 1)) {
+		if (IsDrawnRow(Y) && DrawnHashes[Y] == RowHashes[Y])
+			ClearRowDamage(Y);
+		else
+			Remaining = 1;
+	}
+
+	HasDamage = Remaining;
+
+	return;
+}
+
+/* Called once the damage has settled. Rows drawn at a reduced depth don't match. */
+static void UpdateDrawnRows()
+{
+	int Y;
+
+	if (DrawnHeight != Height) {
+		unsigned long long *New;
+
+		New = realloc(DrawnHashes, Height * (sizeof(unsigned long long) + 1));
+		if (!New) {
+			FreeDrawnRows();
+			return;
+		}
+		DrawnHashes = New;
+		DrawnRows = (char *)&New[Height];
+		DrawnHeight = Height;
+	}
+	DrawnWidth = Width;
+
+	for (Y = 0; Y < Height; Y++) {
+		DrawnHashes[Y] = RowHashes[Y];
+		DrawnRows[Y] = !AdaptiveColors && !IsRowDamaged(Y);
+	}
+
+	return;
+}
+
+static void FreeDrawnRows()
+{
+	free(DrawnHashes);
+	DrawnHashes = NULL;
+	DrawnRows = NULL;
+	DrawnWidth = DrawnHeight = 0;
+
+	return;
+}
+
+/* Scrolling. Rows of Buffer that have moved from elsewhere in Current are found by hashing,
+   then shifted on the terminal within a scroll region, rather than being redrawn. */
+#define	MAX_SCROLL_PASSES	4
+
+static unsigned long long *OldHashes, *NewHashes;
+static int HashRows;
+
+static int IsSameRow(const HexChar *A, const HexChar *B)
+{
+	return IsSameSpan(A, B, Width);
+}
+
+/* In bytes, as with everything else here. */
+static int GetRowChangesCost(int Y, int Rows)
+{
+	TermState T = *Term;
+
+	return GetRedrawCost(&T, &Current->Data[Y * Width], &Buffer->Data[Y * Width], Rows * Width);
+}
+
+/* Cells which are already correct, but will need drawing again after being scrolled off. */
+static int GetRowLossesCost(int Y, int Rows)
+{
+	const HexChar *B = &Current->Data[Y * Width], *BD = &Buffer->Data[Y * Width];
+	TermState T = *Term;
+	int I, Cost = 0;
+
+	for (I = 0; I < Rows * Width; I++) {
+		if (IsSameChar(&B[I], &BD[I]) && !IsBlank(&BD[I]))
+			Cost += GetDrawCost(&T, &BD[I]);
+	}
+
+	return Cost;
+}
+
+/* What ScrollRows() will send. */
+static int GetScrollCost(int Top, int Bottom, int Shift)
+{
+	TermState T = *Term;
+	MovePlan Plan;
+	char Code[SGR_MAX_SIZE];
+	int Cost;
+
+	Cost = CSI_SIZE(abs(Shift));
+	if (!(Quirks & QUIRK_BACK_COLOR_ERASE))
+		Cost += BuildCursorChange(&T, T.FG, 0, T.Attr, Code);
+
+	/* Setting the region & resetting it, with the cursor left at home in between. */
+	if (Top || Bottom != Height - 1) {
+		Cost += CSI_SIZE(Top + 1) + NumberSize(Bottom + 1) + 1 + sizeof(ESC "[r") - 1;
+		if (!(Quirks & QUIRK_SCROLL_CODES) && Top)
+			Cost += CSI_SIZE(Top);
+	} else if (!(Quirks & QUIRK_SCROLL_CODES))
+		Cost += PlanCursorMove(0, Top, &Plan);
+
+	return Cost;
+}
+
+/* Returns the old row which is the only match for the new row Y, or -1. */
+static int FindMovedRow(int Y)
+{
+	int I, Match = -1;
+
+	for (I = 0; I < Height; I++) {
+		if (I != Y && NewHashes[I] == NewHashes[Y])
+			return -1;
+		if (OldHashes[I] == NewHashes[Y]) {
+			if (Match != -1)
+				return -1;
+			Match = I;
+		}
+	}
+
+	return Match;
+}
+
+/* Rows from Top to Bottom are scrolled by Shift, with positive going down. */
+static void ScrollRows(int Top, int Bottom, int Shift)
+{
+	char EscapeString[64], *Char = EscapeString;
+	HexChar Blank, *Rows = &Current->Data[Top * Width];
+	int Amount, Kept, Region, I;
+
+	Amount = abs(Shift);
+	Kept = (Bottom - Top + 1 - Amount) * Width;
+
+	SetBlankColor();
+
+	Region = Top || Bottom != Height - 1;
+	if (Region) {
+		Char = AppendCSI(Char, Top + 1, ';');
+		Char = AppendNumber(Char, Bottom + 1);
+		*Char++ = 'r';
+		OutputBytes(EscapeString, Char - EscapeString);
+
+		/* Setting the region homes the cursor. */
+		Term->X = Term->Y = 0;
+		Term->OnRightEdge = 0;
+	}
+
+	Char = EscapeString;
+	if (Quirks & QUIRK_SCROLL_CODES)
+		Char = AppendCSI(Char, Amount, Shift < 0 ? 'S' : 'T');
+	else {
+		MoveCursor(0, Top);
+		Char = AppendCSI(Char, Amount, Shift < 0 ? 'M' : 'L');
+	}
+	OutputBytes(EscapeString, Char - EscapeString);
+
+	/* Resetting it homes the cursor as well. */
+	if (Region) {
+		OutputString(ESC "[r");
+
+		Term->X = Term->Y = 0;
+		Term->OnRightEdge = 0;
+	} else if (Term->OnRightEdge)
+		Term->Y = -1;	/* Terminals differ on whether scrolling cancels a pending wrap. */
+
+	Blank = GetBlankChar();
+	if (Shift < 0) {
+		memmove(Rows, &Rows[Amount * Width], Kept * sizeof(HexChar));
+		Rows += Kept;
+	} else
+		memmove(&Rows[Amount * Width], Rows, Kept * sizeof(HexChar));
+	for (I = 0; I < Amount * Width; I++)
+		Rows[I] = Blank;
+
+	/* Invalidates anything we knew about these rows. */
+	SetDamage(0, Top, Width, Bottom - Top + 1);
+
+	return;
+}
+
+static int ScrollPass()
+{
+	int Pass, Y, Top, Bottom, Shift, Gain, BestGain, BestTop, BestBottom, BestShift;
+
+	if (!(Quirks & QUIRK_SCROLL_REGION && Quirks & (QUIRK_SCROLL_CODES | QUIRK_INSERT_LINE_CODES)) || !CanBlankCells())
+		return 0;
+
+	if (HashRows != Height) {
+		unsigned long long *New;
+
+		New = realloc(OldHashes, Height * 2 * sizeof(unsigned long long));
+		if (!New)
+			return 0;
+		OldHashes = New;
+		NewHashes = &New[Height];
+		HashRows = Height;
+	}
+
+	/* Buffer's are kept as it's drawn on, as are those of the rows of Current which still match it. */
+	for (Y = 0; Y < Height; Y++) {
+		OldHashes[Y] = IsDrawnRow(Y) ? DrawnHashes[Y] : GetRowHash(&Current->Data[Y * Width]);
+		NewHashes[Y] = RowHashes[Y];
+	}
+
+	for (Pass = 0; Pass < MAX_SCROLL_PASSES; Pass++) {
+		BestGain = 0;
+		BestTop = BestBottom = BestShift = 0;
+		for (Y = 0; Y < Height; Y++) {
+			int Old;
+
+			if (OldHashes[Y] == NewHashes[Y])
+				continue;
+
+			Old = FindMovedRow(Y);
+			if (Old == -1 || !IsSameRow(&Current->Data[Old * Width], &Buffer->Data[Y * Width]))
+				continue;
+			Shift = Y - Old;
+
+			/* Grow it to cover neighbouring rows which moved the same way, even if they're not unique. */
+			for (Top = Y; Top > 0 && Top - 1 - Shift >= 0 && Top - 1 - Shift < Height &&
+				OldHashes[Top - 1 - Shift] == NewHashes[Top - 1] &&
+				IsSameRow(&Current->Data[(Top - 1 - Shift) * Width], &Buffer->Data[(Top - 1) * Width]); Top--);
+			for (Bottom = Y; Bottom < Height - 1 && Bottom + 1 - Shift >= 0 && Bottom + 1 - Shift < Height &&
+				OldHashes[Bottom + 1 - Shift] == NewHashes[Bottom + 1] &&
+				IsSameRow(&Current->Data[(Bottom + 1 - Shift) * Width], &Buffer->Data[(Bottom + 1) * Width]); Bottom++);
+
+			/* The rows scrolled in will be blank. */
+			Gain = GetRowChangesCost(Top, Bottom - Top + 1);
+			if (Shift < 0)
+				Gain -= GetRowLossesCost(Bottom + 1, -Shift) + GetScrollCost(Top, Bottom - Shift, Shift);
+			else
+				Gain -= GetRowLossesCost(Top - Shift, Shift) + GetScrollCost(Top - Shift, Bottom, Shift);
+
+			if (Gain > BestGain) {
+				BestGain = Gain;
+				BestTop = Top;
+				BestBottom = Bottom;
+				BestShift = Shift;
+			}
+
+			Y = Bottom;
+		}
+
+		if (!BestGain)
+			break;
+
+		if (BestShift < 0) {
+			Top = BestTop;
+			Bottom = BestBottom - BestShift;
+		} else {
+			Top = BestTop - BestShift;
+			Bottom = BestBottom;
+		}
+		ScrollRows(Top, Bottom, BestShift);
+
+		for (Y = Top; Y <= Bottom; Y++)
+			OldHashes[Y] = GetRowHash(&Current->Data[Y * Width]);
+	}
+
+	return Pass;
+}
+
+/* Shifting. When characters have been inserted or deleted within a row, the rest of it is moved along on the terminal. */
+#define	MAX_SHIFT_CELLS		8
+#define	MAX_SHIFT_PASSES	4
+
+/* Shifting could push wide characters apart, or part of one off the edge. */
+static int HasWide(int Y, int X)
+{
+	const HexChar *B = Current->Data;
+	unsigned int I;
+
+	for (I = GetOffset(X, Y, Width); I < GetOffset(Width, Y, Width); I++) {
+		if (GetCellKind(B, I) == CELL_WIDE || GetCellKind(B, I) == CELL_TAIL)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* The bytes needed to redraw the cells from X onwards which would still differ after shifting the row by Shift, with
+   positive being an insert, along with setting the color for the blanks. Cells shifted in from outside the row are blank. */
+static int GetShiftCost(const HexChar *B, const HexChar *BD, int X, int Shift, const HexChar *Blank)
+{
+	TermState T = *Term;
+	char Code[SGR_MAX_SIZE];
+	int Cost = 0, From = X, To = Width;
+
+	if (Shift && !(Quirks & QUIRK_BACK_COLOR_ERASE))
+		Cost += BuildCursorChange(&T, T.FG, 0, T.Attr, Code);
+
+	if (Shift > 0) {
+		/* The inserted blanks, with what was at X starting after them. */
+		for (; From < X + Shift && From < Width; From++) {
+			if (!IsSameChar(Blank, &BD[From]))
+				Cost += GetDrawCost(&T, &BD[From]);
+		}
+	} else if (Shift < 0)
+		To = Width + Shift;
+
+	if (From < To)
+		Cost += GetRedrawCost(&T, &B[From - Shift], &BD[From], To - From);
+
+	if (Shift < 0) {
+		for (X = To > From ? To : From; X < Width; X++) {
+			if (!IsSameChar(Blank, &BD[X]))
+				Cost += GetDrawCost(&T, &BD[X]);
+		}
+	}
+
+	return Cost;
+}
+
+static void ShiftCells(int X, int Y, int Shift)
+{
+	char EscapeString[16], *Char;
+	HexChar Blank, *B = &Current->Data[Y * Width];
+	int Amount, I;
+
+	Amount = abs(Shift);
+
+	SetBlankColor();
+	MoveCursor(X, Y);
+
+	Char = AppendCSI(EscapeString, Amount, Shift > 0 ? '@' : 'P');
+	OutputBytes(EscapeString, Char - EscapeString);
+
+	Blank = GetBlankChar();
+	if (Shift > 0) {
+		memmove(&B[X + Amount], &B[X], (Width - X - Amount) * sizeof(HexChar));
+		for (I = X; I < X + Amount; I++)
+			B[I] = Blank;
+	} else {
+		memmove(&B[X], &B[X + Amount], (Width - X - Amount) * sizeof(HexChar));
+		for (I = Width - Amount; I < Width; I++)
+			B[I] = Blank;
+	}
+
+	SetDamage(X, Y, Width - X, 1);
+
+	return;
+}
+
+static int ShiftPass()
+{
+	const HexChar *B, *BD;
+	const char *D;
+	HexChar Blank;
+	MovePlan Plan;
+	int Y, X, Pass, Shift, Cost, BestCost, BestShift, Shifts = 0;
+
+	if (!(Quirks & (QUIRK_INSERT_CHAR_CODE | QUIRK_DELETE_CHAR_CODE)) || !CanBlankCells())
+		return 0;
+
+	for (Y = NextDamagedRow(0); Y < Height; Y = NextDamagedRow(Y + 1)) {
+		D = &Damage[Y * Width];
+		B = &Current->Data[Y * Width];
+		BD = &Buffer->Data[Y * Width];
+
+		for (Pass = 0; Pass < MAX_SHIFT_PASSES; Pass++) {
+			/* The shift has to start where the row first differs. */
+			for (X = DamageSpans[Y * 2]; X < Width && (!D[X] || IsSameChar(&B[X], &BD[X])); X++);
+			if (X >= Width - 1 || HasWide(Y, X))
+				break;
+
+			Blank = GetBlankChar();
+			BestCost = GetShiftCost(B, BD, X, 0, &Blank);
+			BestShift = 0;
+
+			for (Shift = -MAX_SHIFT_CELLS; Shift <= MAX_SHIFT_CELLS; Shift++) {
+				if (!Shift || X + abs(Shift) >= Width)
+					continue;
+
+				/* Quickly rules out most of them. */
+				if (Shift > 0 ? !(Quirks & QUIRK_INSERT_CHAR_CODE) || !IsSameChar(&B[X], &BD[X + Shift]) :
+					!(Quirks & QUIRK_DELETE_CHAR_CODE) || !IsSameChar(&B[X - Shift], &BD[X]))
+					continue;
+
+				Cost = PlanCursorMove(X, Y, &Plan) + CSI_SIZE(abs(Shift)) + GetShiftCost(B, BD, X, Shift, &Blank);
+				if (Cost < BestCost) {
+					BestCost = Cost;
+					BestShift = Shift;
+				}
+			}
+
+			if (!BestShift)
+				break;
+
+			ShiftCells(X, Y, BestShift);
+			Shifts++;
+		}
+	}
+
+	return Shifts;
+}
+
+/* Whether the terminal has a wide character crossing the left or right edge of the area, on any of its rows.
+   Terminals differ on what happens to those when only part is changed, so the passes above leave them alone. */
+static int CrossesWide(int X, int Y, int W, int H)
+{
+	const HexChar *B = Current->Data;
+
+	for (; H > 0; Y++, H--) {
+		if (GetCellKind(B, GetOffset(X, Y, Width)) == CELL_TAIL ||
+			(X + W < Width && GetCellKind(B, GetOffset(X + W, Y, Width)) == CELL_TAIL))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* A change to either half of a wide character means drawing both. The terminal may also blank the other half of one it's
+   showing, so those get forgotten & redrawn too. */
+static void ForgetCell(unsigned int I)
+{
+	static const HexChar Forgotten = HEX_SET_CHAR("\xFF\xFF", 0, 0, 0);	/* Never the same as what's in the Buffer. */
+
+	Current->Data[I] = Forgotten;
+	SetDamage(I % Width, I / Width, 1, 1);
+
+	return;
+}
+
+static void WidePass()
+{
+	HexChar *B = Current->Data, *BD = Buffer->Data;
+	unsigned int I, From, To;
+	int Y;
+
+	for (Y = NextDamagedRow(0); Y < Height; Y = NextDamagedRow(Y + 1)) {
+		for (I = Y * Width + DamageSpans[Y * 2]; I < Y * Width + DamageSpans[Y * 2 + 1]; I++) {
+			if (!Damage[I] || !((B[I].CP[0] | BD[I].CP[0]) & 0x80) || IsSameChar(&B[I], &BD[I]))
+				continue;
+
+			From = To = I;
+			while (GetCellKind(B, From) == CELL_TAIL || GetCellKind(BD, From) == CELL_TAIL)
+				From--;
+			while (GetCellKind(B, To) == CELL_WIDE || GetCellKind(BD, To) == CELL_WIDE)
+				To++;
+
+			for (; From <= To; From++) {
+				if (From != I)
+					ForgetCell(From);
+			}
+			I = To;
+		}
+	}
+
+	return;
+}
+
+static void FreeScrolling()
+{
+	free(OldHashes);
+	OldHashes = NewHashes = NULL;
+	HashRows = 0;
+
+	return;
+}
+
+/* Draws the damaged cells from Start up to End. Returns 0 if it had to stop once the output reached Limit, which is
+   only checked when Limited. */
+static ALWAYS_INLINE int DrawDamageWith(unsigned int Start, unsigned int End, size_t Limit, unsigned int *Cursor, int *First,
+	int Rep, int Ech, int Bce, int Limited)
+{
+	unsigned int I;
+	HexChar *B = Current->Data, *BD = Buffer->Data;
+	int X, Y;
+
+	for (I = Start; I < End; I++) {
+		I = FindChange(B, BD, I, End);
+		if (I >= End)
+			break;
+		if (Limited && GetOutputTotal() >= Limit)
+			return 0;
+		Damage[I] = 0;
+
+		/* Only reached on its own when the area drawn starts on it. */
+		if (IsTail(&BD[I]) && GetCellKind(BD, I) == CELL_TAIL)
+			I--;
+
+		if (*Cursor != I) {
+			/* On the edge, the cursor is actually past where we think it is. */
+			if ((*First && Term->OnRightEdge) || !BridgeGap(*Cursor, I)) {
+				X = I % Width;
+				Y = I / Width;
+				MoveCursor(X, Y);
+			}
+		} else if (*First && Term->OnRightEdge) {
+			/* If on edge, we'll need to send a NOOP move code in order for the cursor to remain in place. */
+			if (Quirks & QUIRK_WRAPPING_FIX)
+				OutputString(ESC "[D");
+			OutputString(ESC "[C");
+			Term->OnRightEdge = 0;
+		}
+		*First = 0;
+
+		if (NeedsCursorChange(&BD[I]))
+			ChangeCursor(BD[I].FG, BD[I].BG, BD[I].Attr);
+
+		I += OutputRunWith(BD, I, 0, Cursor, Rep, Ech, Bce) - 1;
+	}
+
+	return 1;
+}
+
+/* A variant for each set of quirks, so they aren't checked on every cell. One is picked once detection is done. */
+typedef int (*DrawRoutine)(unsigned int Start, unsigned int End, size_t Limit, unsigned int *Cursor, int *First);
+
+#define	DRAW_VARIANT(N)	\
+	static int DrawDamage##N(unsigned int Start, unsigned int End, size_t Limit, unsigned int *Cursor, int *First) \
+	{ \
+		return DrawDamageWith(Start, End, Limit, Cursor, First, (N) & 1, (N) & 2, (N) & 4, (N) & 8); \
+	}
+
+DRAW_VARIANT(0) DRAW_VARIANT(1) DRAW_VARIANT(2) DRAW_VARIANT(3)
+DRAW_VARIANT(4) DRAW_VARIANT(5) DRAW_VARIANT(6) DRAW_VARIANT(7)
+DRAW_VARIANT(8) DRAW_VARIANT(9) DRAW_VARIANT(10) DRAW_VARIANT(11)
+DRAW_VARIANT(12) DRAW_VARIANT(13) DRAW_VARIANT(14) DRAW_VARIANT(15)
+
+static const DrawRoutine DrawVariants[16] = {
+	DrawDamage0, DrawDamage1, DrawDamage2, DrawDamage3,
+	DrawDamage4, DrawDamage5, DrawDamage6, DrawDamage7,
+	DrawDamage8, DrawDamage9, DrawDamage10, DrawDamage11,
+	DrawDamage12, DrawDamage13, DrawDamage14, DrawDamage15
+};
+
+static DrawRoutine DrawDamage, DrawDamageLimited;
+
+static void SelectDrawRoutines()
+{
+	int N = 0;
+
+	if (Quirks & QUIRK_REP_CODE)
+		N |= 1;
+	if (Quirks & QUIRK_ECH_CODE)
+		N |= 2;
+	if (Quirks & QUIRK_BACK_COLOR_ERASE)
+		N |= 4;
+
+	TerminalColors = GetTerminalColors();
+	DrawDamage = DrawVariants[N];
+	DrawDamageLimited = DrawVariants[N | 8];
+
+	return;
+}
+
+/* Priority areas go first, clipped to the current size. */
+static int DrawPriorities(DrawRoutine Draw, size_t Limit, unsigned int *Cursor, int *First)
+{
+	int P, X, Y, W, H;
+
+	for (P = 0; P < PriorityCount; P++) {
+		X = Priorities[P][0]; Y = Priorities[P][1];
+		W = Priorities[P][2]; H = Priorities[P][3];
+
+		if (X < 0) {
+			W += X;
+			X = 0;
+		}
+		if (Y < 0) {
+			H += Y;
+			Y = 0;
+		}
+		if (X + W > Width)
+			W = Width - X;
+		if (Y + H > Height)
+			H = Height - Y;
+
+		for (; H > 0; Y++, H--) {
+			if (IsRowDamaged(Y) && !Draw(GetOffset(X, Y, Width), GetOffset(X + W, Y, Width), Limit, Cursor, First))
+				return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* Then each damaged row, over just the span of columns that changed. */
+static int DrawDamagedRows(DrawRoutine Draw, size_t Limit, unsigned int *Cursor, int *First)
+{
+	const int *Span;
+	int Y;
+
+	for (Y = NextDamagedRow(0); Y < Height; Y = NextDamagedRow(Y + 1)) {
+		Span = &DamageSpans[Y * 2];
+		if (!Draw(GetOffset(Span[0], Y, Width), GetOffset(Span[1], Y, Width), Limit, Cursor, First))
+			return 0;
+		ClearRowDamage(Y);
+	}
+
+	return 1;
+}
+
+/* Parallel drawing. Large changes have their damaged rows split into bands, which are drawn at the same time into their
+   own chunks of output. Past the first, each band starts from a reset style & an unknown cursor, which can only be moved
+   absolutely, so the chunks can be joined as they are. */
+#define	MAX_BANDS		8
+#define	PARALLEL_MIN_CELLS	8192	/* Less isn't worth waking the workers for. */
+
+typedef struct Band {
+	int Top, Bottom;	/* Bottom is one past. */
+	TermState Term;
+	unsigned int Cursor;
+	int First;
+} Band;
+
+static Band Bands[MAX_BANDS];
+
+static void DrawBand(int N)
+{
+	Band *B = &Bands[N];
+	const int *Span;
+	int Y;
+
+	Term = &B->Term;
+	BeginChunk(N);
+
+	if (N)
+		OutputString(ESC "[0m");
+
+	for (Y = NextDamagedRow(B->Top); Y < B->Bottom; Y = NextDamagedRow(Y + 1)) {
+		Span = &DamageSpans[Y * 2];
+		DrawDamage(GetOffset(Span[0], Y, Width), GetOffset(Span[1], Y, Width), (size_t)-1, &B->Cursor, &B->First);
+	}
+
+	EndChunk();
+	Term = &MainTerm;
+
+	return;
+}
+
+/* Rows are shared out by the size of their spans. */
+static int SplitBands(int Count, unsigned int Damaged)
+{
+	unsigned int Sum = 0;
+	int Y, N = 0;
+
+	Bands[0].Top = 0;
+	for (Y = NextDamagedRow(0); Y < Height; Y = NextDamagedRow(Y + 1)) {
+		Sum += DamageSpans[Y * 2 + 1] - DamageSpans[Y * 2];
+		if (N < Count - 1 && Sum >= Damaged / Count * (N + 1)) {
+			Bands[N].Bottom = Y + 1;
+			Bands[++N].Top = Y + 1;
+		}
+	}
+	Bands[N].Bottom = Height;
+
+	/* Reaching the share on the last damaged row leaves a band with nothing to draw. */
+	if (N && NextDamagedRow(Bands[N].Top) >= Height)
+		Bands[--N].Bottom = Height;
+
+	return N + 1;
+}
+
+/* Anything drawn by a band that couldn't be output has to be done again. Only its spans were drawn. */
+static void ForgetBand(const Band *B)
+{
+	unsigned int I, End;
+	int Y;
+
+	for (Y = NextDamagedRow(B->Top); Y < B->Bottom; Y = NextDamagedRow(Y + 1)) {
+		End = GetOffset(DamageSpans[Y * 2 + 1], Y, Width);
+		for (I = GetOffset(DamageSpans[Y * 2], Y, Width); I < End; I++)
+			ForgetCell(I);
+	}
+
+	return;
+}
+
+/* Leaves the rows it couldn't draw damaged, for drawing as usual. */
+static void DrawParallel(unsigned int *Cursor, int *First)
+{
+	unsigned int Damaged = 0;
+	int Y, N, Count;
+
+	for (Y = NextDamagedRow(0); Y < Height; Y = NextDamagedRow(Y + 1))
+		Damaged += DamageSpans[Y * 2 + 1] - DamageSpans[Y * 2];
+	if (Damaged < PARALLEL_MIN_CELLS)
+		return;
+
+	Count = StartWorkers();
+	if (Count > MAX_BANDS)
+		Count = MAX_BANDS;
+	if (Count < 2 || !ReserveChunks(Count))
+		return;
+
+	Count = SplitBands(Count, Damaged);
+	for (N = 0; N < Count; N++) {
+		Band *B = &Bands[N];
+
+		if (N) {
+			memset(&B->Term, 0, sizeof(TermState));
+			B->Term.Y = -1;
+			B->Cursor = -1;
+			B->First = 0;
+		} else {
+			B->Term = MainTerm;
+			B->Cursor = *Cursor;
+			B->First = *First;
+		}
+	}
+
+	RunJobs(DrawBand, Count);
+
+	for (N = 0; N < Count; N++) {
+		Band *B = &Bands[N];
+
+		if (!JoinChunk(N)) {
+			ForgetBand(B);
+
+			/* Whatever came before, the next band starts afresh. */
+			OutputString(ESC "[0m");
+			memset(&MainTerm, 0, sizeof(TermState));
+			MainTerm.Y = -1;
+			*Cursor = -1;
+			continue;
+		}
+
+		for (Y = NextDamagedRow(B->Top); Y < B->Bottom; Y = NextDamagedRow(Y + 1))
+			ClearRowDamage(Y);
+
+		MainTerm = B->Term;
+		*Cursor = B->Cursor;
+		*First = B->First;
+	}
+
+	return;
+}
+
+/* A Budget of 0 has no limit. Otherwise drawing stops once that many bytes have been output, with the rest
+   kept for the next call. */
+static int FlushDamage(size_t Budget, int CurX, int CurY)
+{
+	int Sync = 0, Done = 1;
+
+	if (Flags & HEX_FLAG_OUTPUT_SKIP_FRAMES && (!DrainOutput() || IsOutputBehind())) {
+		CountSkippedFrame();
+		return 0;
+	}
+
+	if (Flags & HEX_FLAG_OUTPUT_ADAPTIVE_COLOR)
+		AdaptColorDepth();
+	else if (AdaptiveColors)
+		RestoreColorDepth();
+
+	if (HasDamage)
+		SkipDrawnRows();
+
+	if (HasDamage) {
+		unsigned int Cursor;
+		size_t Limit;
+		int First = 1;
+		DrawRoutine Draw;
+
+		Limit = Budget ? GetOutputTotal() + Budget : (size_t)-1;
+
+		/* Only worth it when something is likely to be drawn. */
+		Sync = UseSyncOutput();
+		if (Sync)
+			OutputString(ESC "[?2026h");
+
+		ScrollPass();
+		RectPass();
+		/* Would leave the screen blank for a while. */
+		if (!Budget)
+			ClearScreenPass();
+		ShiftPass();
+		WidePass();
+		Cursor = GetOffset(Term->X, Term->Y, Width);
+
+		Draw = Budget ? DrawDamageLimited : DrawDamage;
+		/* The priorities belong to the app, which may be changing them while in the background. */
+		Done = Buffer != Terminal || DrawPriorities(Draw, Limit, &Cursor, &First);
+		if (Done && !Budget && Flags & HEX_FLAG_OUTPUT_PARALLEL)
+			DrawParallel(&Cursor, &First);
+		Done = Done && DrawDamagedRows(Draw, Limit, &Cursor, &First);
+		HasDamage = !Done;
+		UpdateDrawnRows();
+	}
+
+	if (CurX >= 0) {
+		HexClipCursor(&CurX, &CurY);
+		MoveCursor(CurX, CurY);
+	}
+
+	if (Sync)
+		OutputString(ESC "[?2026l");
+
+	if (Flags & HEX_FLAG_OUTPUT_SKIP_FRAMES)
+		DrainOutput();
+	else
+		FlushOutput();
+	return Done;
+}
+
+/* Core screen output function. Returns 0 if the frame was skipped, in which case the changes are kept for the next. */
+int HexFlush(int CurX, int CurY)
+{
+	StopAsync();
+	if (UpdateTerminalColors())
+		return HexFullFlush(1, CurX, CurY);
+	return FlushDamage(0, CurX, CurY);
+}
+
+/* For slow links. Returns 0 if there's still more to be drawn, or the frame was skipped. */
+int HexFlushBudget(size_t Budget, int CurX, int CurY)
+{
+	StopAsync();
+	if (UpdateTerminalColors())
+		return HexFullFlush(1, CurX, CurY);
+	return FlushDamage(Budget, CurX, CurY);
+}
+
+/* Called from the writer thread, which has the flush to itself. */
+int FlushStaged(int CurX, int CurY)
+{
+	return FlushDamage(0, CurX, CurY);
+}
+
+/* Full redraw. Should be called after a resize or restore event. */
+int HexFullFlush(int UseBuffer, int CurX, int CurY)
+{
+	unsigned int I, Cursor;
+	const size_t Total = Current->W * Current->H;
+	HexChar *BD;
+	int Sync;
+
+	StopAsync();
+	UpdateTerminalColors();
+	BD = UseBuffer ? Buffer->Data : Current->Data;
+
+	Sync = UseSyncOutput();
+	if (Sync)
+		OutputString(ESC "[?2026h");
+
+	/* Everything is sent anyway. */
+	RecordedOps = 0;
+
+	/* We can't be certain where the cursor is, so we'll just reset. */
+	OutputString(ESC "[H");
+	Term->X = Term->Y = 0;
+	Term->OnRightEdge = 0;
+	Cursor = 0;
+
+	/* Covered cells are copied into Current as they go. */
+	for (I = 0; I < Total; I++) {
+		if (Cursor != I)
+			MoveCursor(I % Width, I / Width);
+
+		if (NeedsCursorChange(&BD[I]))
+			ChangeCursor(BD[I].FG, BD[I].BG, BD[I].Attr);
+
+		I += OutputRun(BD, I, 1, &Cursor) - 1;
+	}
+
+	if (UseBuffer)
+		ClearDamage();
+	UpdateDrawnRows();
+
+	if (CurX >= 0) {
+		HexClipCursor(&CurX, &CurY);
+		MoveCursor(CurX, CurY);
+	}
+
+	if (Sync)
+		OutputString(ESC "[?2026l");
+
+	FlushOutput();
+	return 1;
+}
+
+/* Doesn't seem that we can rely on the terminal being in any state, so we'll reset all. */
+int ContinueHandler()
+{
+	struct sigaction NewHandler;
+	int PreviousFlags;
+	const char *Hint;
+
+	StopAsync();
+
+	/* As we have no way of knowing if the terminal has been resized during the down time, we'll force one. */
+	GotResizeSignal = 0;
+	if (!ResizeBuffers())
+		return 0;
+	ExtendOutputBuffer();
+
+	memset(&NewHandler, 0, sizeof(NewHandler));
+	NewHandler.sa_handler = ContinueEvent;
+	sigemptyset(&NewHandler.sa_mask);
+	if (sigaction(SIGCONT, &NewHandler, NULL) == -1)
+		return 0;
+	NewHandler.sa_handler = ResizeEvent;
+	if (sigaction(SIGWINCH, &NewHandler, NULL) == -1)
+		return 0;
+
+	ChangeCursor(0, 0, 0);
+
+	Hint = GetTermInfoString(HINT_STR_ENTER_CA_MODE);
+	if (Hint)
+		OutputString(Hint);
+
+	PreviousFlags = Flags;
+	Flags = ~Flags;
+	HexChangeFlags(&PreviousFlags);
+	
+	if (!ContinueInputHandler())
+		return 0;
+
+	FlushOutput();
+	return 1;
+}
+
+/* No reliable way to ensure that the terminal resized, even to what the user wanted, so return the size as well. */
+int HexResize(int *W, int *H)
+{
+	struct winsize Size;
+	int Return;
+
+	HexFlushWait();
+	OutputFormat(ESC "[8;%d;%dt", *H, *W);
+	FlushOutput();
 
 	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &Size) == -1)
 		return 0;
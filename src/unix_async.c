@@ -0,0 +1,333 @@
+/*
+	Hexes Terminal Library
+	Unix background flushing. What's been drawn is staged for a writer thread, which flushes it from a copy of its own
+	while the app carries on drawing.
+
+	Written by Richard Walmsley <richwalm@gmail.com>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "hexes.h"
+
+#define	ROW_BITS	(sizeof(unsigned long) * CHAR_BIT)
+#define	ROW_WORDS(H)	(((H) + ROW_BITS - 1) / ROW_BITS)
+
+extern HexBuffer *Buffer, *Terminal;
+extern int Width, Height;
+extern char *Damage, *TermDamage;
+extern int HasDamage;
+extern unsigned long *DamagedRows, *TermRows;
+extern int *DamageSpans, *TermSpans;
+extern unsigned long long *RowHashes, *TermHashes;
+extern unsigned int SkippedFrames;
+
+int IsRowSet(const unsigned long *Rows, int Y);
+int NextRowSet(const unsigned long *Rows, int Y);
+void MarkRows(unsigned long *Rows, int *Spans, int X, int Y, int W, int H);
+void MarkDamage(int X, int Y, int W, int H);
+int FlushStaged(int CurX, int CurY);
+int TerminalColorsChanged();
+
+/* Cells along with their damage, kept in the same way as the terminal buffer's. */
+typedef struct Frame {
+	HexBuffer *Buffer;
+	char *Damage;
+	unsigned long *Rows;
+	int *Spans;
+	unsigned long long *Hashes;
+} Frame;
+
+/* The flush's own copy, which it works from in place of the terminal buffer, & the changes waiting to be merged into it.
+   Staged cells are only kept within the spans. */
+static Frame Shadow, Staged;
+
+static pthread_t Writer;
+static int Started, Stopping;
+
+static pthread_mutex_t Lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t Wake = PTHREAD_COND_INITIALIZER, Idle = PTHREAD_COND_INITIALIZER;
+
+static int Pending, Writing, LastResult = 1;
+static int StagedX, StagedY;
+
+static void FreeFrame(Frame *F)
+{
+	HexFreeBuffer(F->Buffer);
+	free(F->Damage);
+	free(F->Rows);
+	free(F->Spans);
+	free(F->Hashes);
+	memset(F, 0, sizeof(Frame));
+
+	return;
+}
+
+static int NewFrame(Frame *F)
+{
+	F->Buffer = HexNewBuffer(Width, Height);
+	F->Damage = calloc(Width * Height, 1);
+	F->Rows = calloc(ROW_WORDS(Height), sizeof(unsigned long));
+	F->Spans = malloc(Height * 2 * sizeof(int));
+	F->Hashes = malloc(Height * sizeof(unsigned long long));
+	if (F->Buffer && F->Damage && F->Rows && F->Spans && F->Hashes)
+		return 1;
+
+	FreeFrame(F);
+	return 0;
+}
+
+/* Moves a row's span of damage from one set to another, along with the cells. */
+static void MoveSpan(HexChar *DD, char *DDamage, const HexChar *SD, char *SDamage, int From, int To)
+{
+	int I;
+
+	memcpy(&DD[From], &SD[From], (To - From) * sizeof(HexChar));
+
+	for (I = From; I < To; I++)
+		DDamage[I] |= SDamage[I];
+	memset(&SDamage[From], 0, To - From);
+
+	return;
+}
+
+/* Called with the lock held. The staged spans are widened to take in what's been drawn since, which is all copied
+   across from the terminal buffer as it's the most recent. */
+static void StageRows()
+{
+	int Y, Offset;
+	const int *Span;
+
+	for (Y = NextRowSet(TermRows, 0); Y < Height; Y = NextRowSet(TermRows, Y + 1)) {
+		Span = &TermSpans[Y * 2];
+		MarkRows(Staged.Rows, Staged.Spans, Span[0], Y, Span[1] - Span[0], 1);
+
+		Offset = Y * Width;
+		Span = &Staged.Spans[Y * 2];
+		MoveSpan(&Staged.Buffer->Data[Offset], &Staged.Damage[Offset], &Terminal->Data[Offset], &TermDamage[Offset],
+			Span[0], Span[1]);
+		Staged.Hashes[Y] = TermHashes[Y];
+
+		TermRows[Y / ROW_BITS] &= ~(1UL << (Y % ROW_BITS));
+	}
+
+	return;
+}
+
+/* Called with the lock held, by the writer. */
+static void TakeStaged()
+{
+	int Y, Offset;
+	const int *Span;
+
+	for (Y = NextRowSet(Staged.Rows, 0); Y < Height; Y = NextRowSet(Staged.Rows, Y + 1)) {
+		Span = &Staged.Spans[Y * 2];
+
+		Offset = Y * Width;
+		MoveSpan(&Buffer->Data[Offset], &Damage[Offset], &Staged.Buffer->Data[Offset], &Staged.Damage[Offset],
+			Span[0], Span[1]);
+		MarkDamage(Span[0], Y, Span[1] - Span[0], 1);
+		RowHashes[Y] = Staged.Hashes[Y];
+
+		Staged.Rows[Y / ROW_BITS] &= ~(1UL << (Y % ROW_BITS));
+	}
+
+	return;
+}
+
+static void *WriterMain(void *Unused)
+{
+	int X, Y, Result;
+
+	pthread_mutex_lock(&Lock);
+	for (;;) {
+		while (!Pending && !Stopping)
+			pthread_cond_wait(&Wake, &Lock);
+		if (Stopping)
+			break;
+
+		TakeStaged();
+		X = StagedX;
+		Y = StagedY;
+		Pending = 0;
+		Writing = 1;
+
+		pthread_mutex_unlock(&Lock);
+		Result = FlushStaged(X, Y);
+		pthread_mutex_lock(&Lock);
+
+		Writing = 0;
+		LastResult = Result;
+		if (!Pending)
+			pthread_cond_broadcast(&Idle);
+	}
+	pthread_mutex_unlock(&Lock);
+
+	return NULL;
+}
+
+static int StartWriter()
+{
+	sigset_t All, Old;
+
+	if (Started)
+		return 1;
+
+	/* Signals are left to the main thread. */
+	sigfillset(&All);
+	pthread_sigmask(SIG_SETMASK, &All, &Old);
+	Started = !pthread_create(&Writer, NULL, WriterMain, NULL);
+	pthread_sigmask(SIG_SETMASK, &Old, NULL);
+
+	return Started;
+}
+
+/* The flush carries on with a copy of where it was, leaving what's drawn from then on to be staged. */
+static int StartAsync()
+{
+	if (!StartWriter() || !NewFrame(&Shadow) || !NewFrame(&Staged)) {
+		FreeFrame(&Shadow);
+		FreeFrame(&Staged);
+		return 0;
+	}
+
+	memcpy(Shadow.Buffer->Data, Buffer->Data, Width * Height * sizeof(HexChar));
+	memcpy(Shadow.Damage, Damage, Width * Height);
+	memcpy(Shadow.Rows, DamagedRows, ROW_WORDS(Height) * sizeof(unsigned long));
+	memcpy(Shadow.Spans, DamageSpans, Height * 2 * sizeof(int));
+	memcpy(Shadow.Hashes, RowHashes, Height * sizeof(unsigned long long));
+
+	Buffer = Shadow.Buffer;
+	Damage = Shadow.Damage;
+	DamagedRows = Shadow.Rows;
+	DamageSpans = Shadow.Spans;
+	RowHashes = Shadow.Hashes;
+
+	memset(TermDamage, 0, Width * Height);
+	memset(TermRows, 0, ROW_WORDS(Height) * sizeof(unsigned long));
+
+	return 1;
+}
+
+/* Once the writer's done, anything it left undone goes back in with what's been drawn since, so the flush can work from
+   the terminal buffer again. Needed before anything else touches the flush. */
+void StopAsync()
+{
+	int Y, Offset;
+	const int *Span;
+
+	if (Buffer == Terminal)
+		return;
+	HexFlushWait();
+
+	for (Y = NextRowSet(DamagedRows, 0); Y < Height; Y = NextRowSet(DamagedRows, Y + 1)) {
+		Span = &DamageSpans[Y * 2];
+		for (Offset = Y * Width + Span[0]; Offset < Y * Width + Span[1]; Offset++)
+			TermDamage[Offset] |= Damage[Offset];
+		MarkRows(TermRows, TermSpans, Span[0], Y, Span[1] - Span[0], 1);
+	}
+
+	Buffer = Terminal;
+	Damage = TermDamage;
+	DamagedRows = TermRows;
+	DamageSpans = TermSpans;
+	RowHashes = TermHashes;
+	HasDamage = NextRowSet(DamagedRows, 0) < Height;
+
+	FreeFrame(&Shadow);
+	FreeFrame(&Staged);
+
+	return;
+}
+
+void FreeAsync()
+{
+	StopAsync();
+
+	if (!Started)
+		return;
+
+	pthread_mutex_lock(&Lock);
+	Stopping = 1;
+	pthread_cond_broadcast(&Wake);
+	pthread_mutex_unlock(&Lock);
+
+	pthread_join(Writer, NULL);
+	Started = Stopping = 0;
+
+	return;
+}
+
+/* Returns once the changes are staged, with the writer flushing them in the background. Should the writer still be busy,
+   they're merged with those it's yet to take. Falls back to HexFlush() if a writer couldn't be started. */
+int HexFlushAsync(int CurX, int CurY)
+{
+	/* Everything's redrawn in the new colors from here. */
+	if (TerminalColorsChanged())
+		return HexFlush(CurX, CurY);
+
+	if (Buffer == Terminal && !StartAsync())
+		return HexFlush(CurX, CurY);
+
+	pthread_mutex_lock(&Lock);
+	StageRows();
+	StagedX = CurX;
+	StagedY = CurY;
+	Pending = 1;
+	pthread_cond_signal(&Wake);
+	pthread_mutex_unlock(&Lock);
+
+	return 1;
+}
+
+/* Whether there's still a frame being written. */
+int HexFlushPending()
+{
+	int Return;
+
+	pthread_mutex_lock(&Lock);
+	Return = Pending || Writing;
+	pthread_mutex_unlock(&Lock);
+
+	return Return;
+}
+
+/* Frames are skipped by whichever thread is flushing, so the count is kept under the lock. */
+void CountSkippedFrame()
+{
+	pthread_mutex_lock(&Lock);
+	SkippedFrames++;
+	pthread_mutex_unlock(&Lock);
+
+	return;
+}
+
+unsigned int HexSkippedFrames()
+{
+	unsigned int Return;
+
+	pthread_mutex_lock(&Lock);
+	Return = SkippedFrames;
+	pthread_mutex_unlock(&Lock);
+
+	return Return;
+}
+
+/* Waits for the writer to finish, returning what the flush of the last frame did. */
+int HexFlushWait()
+{
+	int Return;
+
+	pthread_mutex_lock(&Lock);
+	while (Pending || Writing)
+		pthread_cond_wait(&Idle, &Lock);
+	Return = LastResult;
+	pthread_mutex_unlock(&Lock);
+
+	return Return;
+}
@@ -56,7 +56,11 @@ extern volatile sig_atomic_t GotResizeSignal, GotContinueSignal;
 int ContinueHandler();
 
 int ExtendOutputBuffer();
+int FlushOutput();
+void OutputString(const char *String);
+void OutputFormat(const char *Format, ...);
 int ResizeBuffers();
+void StopAsync();
 
 const char *GetTermInfoName();
 const char *GetTermInfoString(unsigned int N);
@@ -399,7 +403,7 @@ int ContinueInputHandler()
 
 	K = GetTermInfoString(HINT_STR_KEYPAD_XMIT);
 	if (K)
-		fputs(K, stdout);
+		OutputString(K);
 
 	return 1;
 }
@@ -425,7 +429,7 @@ static void LoadInputHints()
 
 	K = GetTermInfoString(HINT_STR_KEYPAD_XMIT);
 	if (K)
-		fputs(K, stdout);
+		OutputString(K);
 
 	Valid = 0;
 
@@ -559,6 +563,7 @@ int HexGetChar(int Timeout, int *Mod)
 
 	if (GotResizeSignal) {
 		GotResizeSignal = 0;
+		StopAsync();
 		if (!ResizeBuffers())
 			return HEX_CHAR_ERROR;
 		ExtendOutputBuffer();
@@ -614,7 +619,7 @@ void FreeInput()
 
 	K = GetTermInfoString(HINT_STR_KEYPAD_LOCAL);
 	if (K)
-		fputs(K, stdout);
+		OutputString(K);
 
 	return;
 }
@@ -755,15 +760,18 @@ int HexEnableMouse(int Type)
 {
 	const int Codes[] = { 9, 1000, 1002, 1003 };
 
+	HexFlushWait();
+
 	if (Type > 0) {
 		/* Set mouse protocol. */
 		if (MouseType == HEX_MOUSE_NONE)
-			fputs(ESC "[?1015h" ESC "[?1006h", stdout);
-		printf(ESC "[?%dh", Codes[Type - 1]);
+			OutputString(ESC "[?1015h" ESC "[?1006h");
+		OutputFormat(ESC "[?%dh", Codes[Type - 1]);
 	} else if (MouseType != HEX_MOUSE_NONE)
-		printf(ESC "[?%dl", Codes[MouseType - 1]);
+		OutputFormat(ESC "[?%dl", Codes[MouseType - 1]);
 
 	MouseType = Type;
+	FlushOutput();
 
 	return 1;
 }
@@ -0,0 +1,392 @@
+/*
+	Hexes Terminal Library
+	Unix output functions. Escape codes & cells are collected into a frame buffer, which is then written in one go.
+
+	Written by Richard Walmsley <richwalm@gmail.com>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "hexes.h"
+
+#define	BUF_BYTES_PER_CELL		16	/* Initial guess. Will grow when needed. */
+#define	BUF_MIN_SIZE			4096
+#define	OUTPUT_BEHIND_BYTES		1024	/* Queued in the terminal driver before we consider it to be lagging. */
+#define	DRAIN_BYTES			PIPE_BUF	/* The most that can be written without blocking once there's room. */
+
+#ifdef __GNUC__
+	#define	THREAD_LOCAL	_Thread_local __attribute__((tls_model("initial-exec")))
+#else
+	#define	THREAD_LOCAL	_Thread_local
+#endif
+
+extern int Width, Height;
+
+static char *OutputBuffer;
+static size_t OutputSize, OutputUsed, OutputTotal;
+static unsigned long WaitedMS;
+
+/* Chunks. Each band of a parallel flush is output into its own by a worker thread, then they're joined in order. */
+typedef struct OutputChunk {
+	char *Data;
+	size_t Size, Used;
+	int Failed;
+} OutputChunk;
+
+static OutputChunk *Chunks;
+static int ChunkCount;
+static THREAD_LOCAL OutputChunk *Chunk;
+
+/* Stdin & stdout usually share the same file description on a terminal, so the non-blocking flag set for input applies here as well. */
+static int WaitForOutput()
+{
+	struct pollfd PFD;
+	struct timespec Start, End;
+	int Return;
+
+	PFD.fd = STDOUT_FILENO;
+	PFD.events = POLLOUT;
+
+	clock_gettime(CLOCK_MONOTONIC, &Start);
+	do {
+		Return = poll(&PFD, 1, -1);
+	} while (Return == -1 && errno == EINTR);
+	clock_gettime(CLOCK_MONOTONIC, &End);
+
+	/* Time stuck here is the best sign of a slow link on a pty, as those don't report what's queued. */
+	WaitedMS += (End.tv_sec - Start.tv_sec) * 1000 + (End.tv_nsec - Start.tv_nsec) / 1000000;
+
+	return Return > 0;
+}
+
+/* Handles short writes, rather than giving up like stdio does. */
+static int WriteAll(const char *Data, size_t Size)
+{
+	ssize_t Return;
+
+	while (Size) {
+		Return = write(STDOUT_FILENO, Data, Size);
+		if (Return == -1) {
+			switch (errno) {
+				case EINTR:
+					continue;
+				case EAGAIN:
+				#if EAGAIN != EWOULDBLOCK
+				case EWOULDBLOCK:
+				#endif
+					if (!WaitForOutput())
+						return 0;
+					continue;
+				default:
+					return 0;
+			}
+		}
+
+		Data += Return;
+		Size -= Return;
+	}
+
+	return 1;
+}
+
+static int ReserveOutput(size_t Size)
+{
+	char *New;
+
+	if (Size <= OutputSize)
+		return 1;
+
+	if (Size < BUF_MIN_SIZE)
+		Size = BUF_MIN_SIZE;
+
+	New = realloc(OutputBuffer, Size);
+	if (!New)
+		return 0;
+
+	OutputBuffer = New;
+	OutputSize = Size;
+
+	return 1;
+}
+
+/* Writes out anything that's been collected. Anything sent via stdio goes first, as it was placed before. */
+int FlushOutput()
+{
+	int Return;
+
+	fflush(stdout);
+
+	Return = WriteAll(OutputBuffer, OutputUsed);
+	OutputUsed = 0;
+
+	return Return;
+}
+
+/* Sends what it can without waiting, keeping the rest for later. Returns 1 once everything has gone.
+   Stdout may well be blocking, so it's only written to while there's room, & no more than what room guarantees. */
+int DrainOutput()
+{
+	struct pollfd PFD;
+	ssize_t Return;
+	size_t Sent = 0, Size;
+
+	fflush(stdout);
+
+	PFD.fd = STDOUT_FILENO;
+	PFD.events = POLLOUT;
+
+	while (Sent < OutputUsed) {
+		Return = poll(&PFD, 1, 0);
+		if (Return == -1 && errno == EINTR)
+			continue;
+		if (Return != 1 || !(PFD.revents & POLLOUT))
+			break;
+
+		Size = OutputUsed - Sent;
+		if (Size > DRAIN_BYTES)
+			Size = DRAIN_BYTES;
+
+		Return = write(STDOUT_FILENO, &OutputBuffer[Sent], Size);
+		if (Return == -1) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		Sent += Return;
+	}
+
+	OutputUsed -= Sent;
+	if (OutputUsed)
+		memmove(OutputBuffer, &OutputBuffer[Sent], OutputUsed);
+
+	return !OutputUsed;
+}
+
+/* What the terminal driver has yet to pass on. */
+static size_t GetDriverQueued()
+{
+	#ifdef TIOCOUTQ
+	int Queued;
+
+	if (ioctl(STDOUT_FILENO, TIOCOUTQ, &Queued) != -1 && Queued > 0)
+		return Queued;
+	#endif
+
+	return 0;
+}
+
+/* Checks if the terminal still has plenty queued from before, even after we've written it all. */
+int IsOutputBehind()
+{
+	return GetDriverQueued() > OUTPUT_BEHIND_BYTES;
+}
+
+/* Everything that's yet to reach the terminal, including what we're holding onto. */
+size_t GetQueuedOutput()
+{
+	return OutputUsed + GetDriverQueued();
+}
+
+/* There's no writing to the terminal from a worker, so running out of memory fails the whole chunk. */
+static void ChunkBytes(const char *Data, size_t Size)
+{
+	size_t Needed;
+
+	if (Chunk->Failed)
+		return;
+
+	Needed = Chunk->Used + Size;
+	if (Needed > Chunk->Size) {
+		size_t NewSize;
+		char *New;
+
+		NewSize = Chunk->Size * 2;
+		if (NewSize < BUF_MIN_SIZE)
+			NewSize = BUF_MIN_SIZE;
+		if (NewSize < Needed)
+			NewSize = Needed;
+
+		New = realloc(Chunk->Data, NewSize);
+		if (!New) {
+			Chunk->Failed = 1;
+			return;
+		}
+		Chunk->Data = New;
+		Chunk->Size = NewSize;
+	}
+
+	memcpy(&Chunk->Data[Chunk->Used], Data, Size);
+	Chunk->Used += Size;
+
+	return;
+}
+
+void OutputBytes(const char *Data, size_t Size)
+{
+	size_t Needed;
+
+	if (Chunk) {
+		ChunkBytes(Data, Size);
+		return;
+	}
+
+	OutputTotal += Size;
+
+	Needed = OutputUsed + Size;
+	if (Needed > OutputSize) {
+		size_t NewSize;
+
+		NewSize = OutputSize * 2;
+		if (NewSize < Needed)
+			NewSize = Needed;
+
+		/* Out of memory. Empty what we have and try again, otherwise bypass the buffer completely. */
+		if (!ReserveOutput(NewSize)) {
+			FlushOutput();
+			if (Size > OutputSize) {
+				WriteAll(Data, Size);
+				return;
+			}
+		}
+	}
+
+	memcpy(&OutputBuffer[OutputUsed], Data, Size);
+	OutputUsed += Size;
+
+	return;
+}
+
+void OutputString(const char *String)
+{
+	OutputBytes(String, strlen(String));
+	return;
+}
+
+void OutputFormat(const char *Format, ...)
+{
+	char Small[128], *Large;
+	va_list Args;
+	int Size;
+
+	va_start(Args, Format);
+	Size = vsnprintf(Small, sizeof(Small), Format, Args);
+	va_end(Args);
+
+	if (Size < 0)
+		return;
+	if (Size < sizeof(Small)) {
+		OutputBytes(Small, Size);
+		return;
+	}
+
+	/* Only likely with long titles. */
+	Large = malloc(Size + 1);
+	if (!Large)
+		return;
+
+	va_start(Args, Format);
+	vsnprintf(Large, Size + 1, Format, Args);
+	va_end(Args);
+
+	OutputBytes(Large, Size);
+	free(Large);
+
+	return;
+}
+
+/* Running total of the time spent waiting for the terminal. */
+unsigned long GetOutputWaited()
+{
+	return WaitedMS;
+}
+
+/* Running count of everything output, for measuring how much something took. */
+size_t GetOutputTotal()
+{
+	return OutputTotal;
+}
+
+/* Makes enough room for a typical full redraw of the current terminal size. */
+int ExtendOutputBuffer()
+{
+	return ReserveOutput((size_t)Width * Height * BUF_BYTES_PER_CELL);
+}
+
+int ReserveChunks(int Count)
+{
+	OutputChunk *New;
+
+	if (Count <= ChunkCount)
+		return 1;
+
+	New = realloc(Chunks, Count * sizeof(OutputChunk));
+	if (!New)
+		return 0;
+	memset(&New[ChunkCount], 0, (Count - ChunkCount) * sizeof(OutputChunk));
+
+	Chunks = New;
+	ChunkCount = Count;
+
+	return 1;
+}
+
+/* Output from the calling thread goes into chunk N, until it ends. */
+void BeginChunk(int N)
+{
+	Chunk = &Chunks[N];
+	Chunk->Used = 0;
+	Chunk->Failed = 0;
+
+	return;
+}
+
+void EndChunk()
+{
+	Chunk = NULL;
+	return;
+}
+
+/* Adds chunk N to the output. Returns 0 if it couldn't be completed, in which case nothing is added. */
+int JoinChunk(int N)
+{
+	if (Chunks[N].Failed)
+		return 0;
+
+	OutputBytes(Chunks[N].Data, Chunks[N].Used);
+
+	return 1;
+}
+
+static void FreeChunks()
+{
+	int I;
+
+	for (I = 0; I < ChunkCount; I++)
+		free(Chunks[I].Data);
+	free(Chunks);
+	Chunks = NULL;
+	ChunkCount = 0;
+
+	return;
+}
+
+void FreeOutput()
+{
+	FlushOutput();
+
+	free(OutputBuffer);
+	OutputBuffer = NULL;
+	OutputSize = OutputUsed = 0;
+	FreeChunks();
+
+	return;
+}
@@ -0,0 +1,132 @@
+/*
+	Hexes Terminal Library
+	Unix worker threads. A small pool which runs a set of jobs in parallel, for the flush to split its work across.
+
+	Written by Richard Walmsley <richwalm@gmail.com>
+*/
+
+#include <stdio.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "hexes.h"
+
+#define	MAX_WORKERS	7	/* Along with the calling thread. */
+
+typedef void (*WorkerJob)(int N);
+
+static pthread_t Threads[MAX_WORKERS];
+static int Workers, Started;
+
+static pthread_mutex_t Lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t Wake = PTHREAD_COND_INITIALIZER, Finished = PTHREAD_COND_INITIALIZER;
+
+/* The current set. Each new one bumps the generation, waking the workers. */
+static WorkerJob Job;
+static int Jobs, NextJob, JobsDone, Generation, Stopping;
+
+/* Takes jobs until there's none left. Called with the lock held. */
+static void TakeJobs()
+{
+	int N;
+
+	while (NextJob < Jobs) {
+		N = NextJob++;
+
+		pthread_mutex_unlock(&Lock);
+		Job(N);
+		pthread_mutex_lock(&Lock);
+
+		if (++JobsDone == Jobs)
+			pthread_cond_signal(&Finished);
+	}
+
+	return;
+}
+
+static void *WorkerMain(void *Unused)
+{
+	int Seen;
+
+	pthread_mutex_lock(&Lock);
+	Seen = Generation;
+	for (;;) {
+		while (Generation == Seen && !Stopping)
+			pthread_cond_wait(&Wake, &Lock);
+		if (Stopping)
+			break;
+
+		Seen = Generation;
+		TakeJobs();
+	}
+	pthread_mutex_unlock(&Lock);
+
+	return NULL;
+}
+
+/* Started on first use, with one less than the amount of processors. Returns how many threads there are to work with,
+   including the caller, which is 1 if none could be started. */
+int StartWorkers()
+{
+	sigset_t All, Old;
+	long Processors;
+
+	if (Started)
+		return Workers + 1;
+	Started = 1;
+
+	Processors = sysconf(_SC_NPROCESSORS_ONLN);
+	if (Processors < 2)
+		return 1;
+
+	/* Signals are left to the main thread. */
+	sigfillset(&All);
+	pthread_sigmask(SIG_SETMASK, &All, &Old);
+
+	for (Workers = 0; Workers < MAX_WORKERS && Workers < Processors - 1; Workers++) {
+		if (pthread_create(&Threads[Workers], NULL, WorkerMain, NULL))
+			break;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &Old, NULL);
+
+	return Workers + 1;
+}
+
+/* Runs jobs 0 to Count - 1, with the calling thread taking its share. Returns once they've all finished. */
+void RunJobs(WorkerJob NewJob, int Count)
+{
+	pthread_mutex_lock(&Lock);
+
+	Job = NewJob;
+	Jobs = Count;
+	NextJob = JobsDone = 0;
+	Generation++;
+	pthread_cond_broadcast(&Wake);
+
+	TakeJobs();
+	while (JobsDone < Jobs)
+		pthread_cond_wait(&Finished, &Lock);
+
+	pthread_mutex_unlock(&Lock);
+
+	return;
+}
+
+void FreeWorkers()
+{
+	int I;
+
+	pthread_mutex_lock(&Lock);
+	Stopping = 1;
+	pthread_cond_broadcast(&Wake);
+	pthread_mutex_unlock(&Lock);
+
+	for (I = 0; I < Workers; I++)
+		pthread_join(Threads[I], NULL);
+
+	Workers = Started = Stopping = 0;
+
+	return;
+}
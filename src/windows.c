@@ -25,9 +25,15 @@ extern HexBuffer *Buffer, *Current;
 extern int Width, Height;
 extern char *Damage;
 extern int HasDamage;
+extern int *DamageSpans;
+extern unsigned int SkippedFrames;
 
 int IsSameChar(HexChar *A, HexChar *B);
+int NextDamagedRow(int Y);
+void ClearRowDamage(int Y);
+void ClearDamage();
 int GetU8Size(const unsigned char *Char);
+const char *GetCellBytes(const char *CP, size_t *Size);
 void HexClipCursor(int *X, int *Y);
 int ResizeBuffers();
 
@@ -71,6 +77,17 @@ void HexSetTitle(const char *Title, const char *Icon)
 	return;
 }
 
+/* The console has no rectangular operations, so these are simply redrawn. */
+void RecordFill(int X, int Y, int W, int H, const HexChar *Char, unsigned int Flags)
+{
+	return;
+}
+
+void RecordCopy(int SX, int SY, int X, int Y, int W, int H, unsigned int Flags)
+{
+	return;
+}
+
 static int MoveCursor(int X, int Y)
 {
 	COORD Pos;
@@ -162,12 +179,17 @@ static int GetAttributes(HexChar *Char)
 
 static void HexCharToWinConsole(CHAR_INFO *C, HexChar *HC)
 {
-	/* It appears that the Windows' console is limited to a single UTF-16, two bytes. */
-	if (*HC->CP)
-		if (*HC->CP < 0x80)
-			C->Char.UnicodeChar = *HC->CP;
+	const char *CP;
+	size_t Size;
+
+	/* It appears that the Windows' console is limited to a single UTF-16, two bytes. Clusters are shown as their first
+	   character. */
+	CP = GetCellBytes(HC->CP, &Size);
+	if (*CP && *CP != *HEX_WIDE_TAIL)
+		if (*CP < 0x80)
+			C->Char.UnicodeChar = *CP;
 		else
-			MultiByteToWideChar(CP_UTF8, 0, HC->CP, GetU8Size((const unsigned char *)HC->CP), &C->Char.UnicodeChar, sizeof(WCHAR));
+			MultiByteToWideChar(CP_UTF8, 0, CP, GetU8Size((const unsigned char *)CP), &C->Char.UnicodeChar, sizeof(WCHAR));
 	else
 		C->Char.UnicodeChar = L' ';
 
@@ -269,25 +291,19 @@ void FreeSub()
 int HexFlush(int CurX, int CurY)
 {
 	if (HasDamage) {
-		int I;
-		const size_t Total = Width * Height;
-		char *D = Damage;
+		int I, Y;
 		HexChar *B = Current->Data, *BD = Buffer->Data;
 
-		for (I = 0; I < Total; I++) {
-			if (*D) {
-				*D = 0;
-
-				if (IsSameChar(&B[I], &BD[I])) {
-					D++;
+		for (Y = NextDamagedRow(0); Y < Height; Y = NextDamagedRow(Y + 1)) {
+			for (I = Y * Width + DamageSpans[Y * 2]; I < Y * Width + DamageSpans[Y * 2 + 1]; I++) {
+				if (!Damage[I] || IsSameChar(&B[I], &BD[I]))
 					continue;
-				}
 
 				HexCharToWinConsole(&WinConsoleBuffer[I], &BD[I]);
 
 				B[I] = BD[I];
 			}
-			D++;
+			ClearRowDamage(Y);
 		}
 		HasDamage = 0;
 
@@ -302,6 +318,33 @@ int HexFlush(int CurX, int CurY)
 	return 1;
 }
 
+/* The console is written all at once, so there's nothing to gain from a budget. */
+int HexFlushBudget(size_t Budget, int CurX, int CurY)
+{
+	return HexFlush(CurX, CurY);
+}
+
+/* No writer thread here, so it's flushed right away. */
+int HexFlushAsync(int CurX, int CurY)
+{
+	return HexFlush(CurX, CurY);
+}
+
+int HexFlushPending()
+{
+	return 0;
+}
+
+int HexFlushWait()
+{
+	return 1;
+}
+
+unsigned int HexSkippedFrames()
+{
+	return SkippedFrames;
+}
+
 int HexFullFlush(int UseBuffer, int CurX, int CurY)
 {
 	COORD Size = { Width, Height };
@@ -318,8 +361,7 @@ int HexFullFlush(int UseBuffer, int CurX, int CurY)
 			B[I] = BD[I];
 		}
 
-		memset(Damage, 0, Total);
-		HasDamage = 0;
+		ClearDamage();
 	}
 
 	if (!WriteConsoleOutputW(ConsoleHandle, WinConsoleBuffer, Size, Coord, &Region))
@@ -0,0 +1,85 @@
+/*
+	Hexes Terminal Library
+	Times fills & blits between offscreen buffers of each layout. No terminal is needed.
+
+	Usage: bench_buffers [width] [height]
+
+	Written by Richard Walmsley <richwalm@gmail.com>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "hexes.h"
+
+#define	REPEATS	500
+#define	DRAW_ALL	(HEX_DRAW_CP | HEX_DRAW_FG | HEX_DRAW_BG | HEX_DRAW_ATTR)
+
+static const char *LayoutNames[] = { "chars", "planes" };
+#define	LAYOUT_COUNT	(sizeof(LayoutNames) / sizeof(*LayoutNames))
+
+static double GetTime()
+{
+	struct timespec T;
+
+	clock_gettime(CLOCK_MONOTONIC, &T);
+
+	return T.tv_sec * 1e3 + T.tv_nsec / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+	int W = argc > 1 ? atoi(argv[1]) : 480, H = argc > 2 ? atoi(argv[2]) : 135, I;
+	unsigned int L;
+	HexBuffer *A, *B;
+	HexChar C = HEX_SET_CHAR("#", 3, 4, 1);
+	double Start;
+
+	if (W <= 0 || H <= 0)
+		return 1;
+
+	printf("%dx%d, ms each:\n", W, H);
+	for (L = 0; L < LAYOUT_COUNT; L++) {
+		A = HexNewBufferLayout(W, H, L);
+		B = HexNewBufferLayout(W, H, L);
+		if (!A || !B)
+			return 1;
+
+		printf("%-8s", LayoutNames[L]);
+
+		Start = GetTime();
+		for (I = 0; I < REPEATS; I++) {
+			C.FG = I;
+			HexFillRaw(A, 0, 0, W, H, &C, DRAW_ALL);
+		}
+		printf("  fill %.3f", (GetTime() - Start) / REPEATS);
+
+		Start = GetTime();
+		for (I = 0; I < REPEATS; I++)
+			HexBlitRaw(A, B, 0, 0, 0, 0, W, H, DRAW_ALL);
+		printf("  blit %.3f", (GetTime() - Start) / REPEATS);
+
+		Start = GetTime();
+		for (I = 0; I < REPEATS; I++) {
+			C.BG = I;
+			HexFillRaw(A, 0, 0, W, H, &C, HEX_DRAW_BG);
+		}
+		printf("  fill bg %.3f", (GetTime() - Start) / REPEATS);
+
+		Start = GetTime();
+		for (I = 0; I < REPEATS; I++)
+			HexBlitRaw(A, B, 0, 0, 0, 0, W, H, HEX_DRAW_BG);
+		printf("  blit bg %.3f", (GetTime() - Start) / REPEATS);
+
+		Start = GetTime();
+		for (I = 0; I < REPEATS; I++)
+			HexBlitRaw(A, B, 0, 0, 0, 0, W, H, DRAW_ALL | HEX_DRAW_TRANSPARENT);
+		printf("  transparent blit %.3f\n", (GetTime() - Start) / REPEATS);
+
+		HexFreeBuffer(A);
+		HexFreeBuffer(B);
+	}
+
+	return 0;
+}
@@ -0,0 +1,109 @@
+/*
+	Hexes Terminal Library
+	Times the flush over a number of frames. Needs a terminal, with the figures given once it's been restored. The
+	terminal's speed counts towards them, so compare runs in the same one at the same size.
+
+	Usage: bench_flush [random|sparse|static|moving] [frames] [async]
+		random	A quarter of the screen drawn at random each frame.
+		sparse	A single cell each frame.
+		static	The whole screen redrawn each frame, with little of it changing.
+		moving	As static, with the few cells moving each frame.
+
+	Written by Richard Walmsley <richwalm@gmail.com>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hexes.h"
+
+/* Process time, so time spent waiting on the terminal is left out. */
+static double GetTime()
+{
+	struct timespec T;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &T);
+
+	return T.tv_sec + T.tv_nsec / 1e9;
+}
+
+static void DrawFrame(HexBuffer *T, const char *Mode, int F)
+{
+	HexChar C = HEX_SET_CHAR("a", 0, 0, 0), Blank = HEX_SET_CHAR(" ", 0, 4, 0);
+	int I;
+
+	if (!strcmp(Mode, "sparse")) {
+		C.CP[0] = 'a' + F % 26;
+		HexPutHexChar(T, F % T->W, F % T->H, &C);
+	} else if (!strcmp(Mode, "static") || !strcmp(Mode, "moving")) {
+		int Moving = !strcmp(Mode, "moving");
+
+		HexFill(T, 0, 0, T->W, T->H, &Blank, 0);
+		C.CP[0] = '*';
+		C.FG = 3;
+		C.BG = 4;
+		for (I = 0; I < 40; I++) {
+			if (Moving)
+				HexPutHexChar(T, (F + I * 7) % T->W, (I * 3 + F / 4) % T->H, &C);
+			else
+				HexPutHexChar(T, (I * 7) % T->W, (I * 3 + (F % 50 == 0)) % T->H, &C);
+		}
+	} else {
+		for (I = 0; I < T->W * T->H / 4; I++) {
+			C.CP[0] = "ab  #"[rand() % 5];
+			C.FG = rand() % 3;
+			C.BG = rand() % 2;
+			HexPutHexChar(T, rand() % T->W, rand() % T->H, &C);
+		}
+	}
+
+	if (F % 10 == 0) {
+		C.CP[0] = ' ';
+		HexFill(T, 0, rand() % T->H, T->W, 1, &C, 0);
+	}
+
+	return;
+}
+
+int main(int argc, char **argv)
+{
+	const char *Mode = argc > 1 ? argv[1] : "random";
+	int Frames = argc > 2 ? atoi(argv[2]) : 2000, Async = argc > 3 && !strcmp(argv[3], "async"), F, W, H;
+	double Start, Flush = 0, Total = 0;
+	HexBuffer *T;
+
+	if (Frames <= 0)
+		Frames = 1;
+
+	if (HexInit(0, 0, HEX_INIT_NO_UNICODE_TEST) != HEX_ERROR_NONE) {
+		fprintf(stderr, "Unable to start the terminal.\n");
+		return 1;
+	}
+
+	T = HexGetTerminalBuffer();
+	W = T->W;
+	H = T->H;
+
+	srand(1);
+	for (F = 0; F < Frames; F++) {
+		Start = GetTime();
+		DrawFrame(T, Mode, F);
+
+		Flush -= GetTime();
+		if (Async)
+			HexFlushAsync(-1, -1);
+		else
+			HexFlush(-1, -1);
+		Flush += GetTime();
+		Total += GetTime() - Start;
+	}
+
+	HexFree();
+
+	printf("%s, %dx%d, %d frames%s: %.3f ms a flush, %.3f ms a frame.\n", Mode, W, H, Frames, Async ? ", async" : "",
+		Flush * 1000 / Frames, Total * 1000 / Frames);
+
+	return 0;
+}
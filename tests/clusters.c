@@ -0,0 +1,142 @@
+/*
+	Hexes Terminal Library
+	Checks grapheme clusters are found, interned once & given back through their handles, including once the pool's freed.
+
+	Written by Richard Walmsley <richwalm@gmail.com>
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "hexes.h"
+
+#define	MANY_CLUSTERS	5000	/* Past a page of them & a few growths of the table. */
+
+extern int Unicode;
+
+int GetClusterSize(const char *String, size_t Length);
+int InternCluster(char *CP, const char *String, int Size);
+int IsCluster(const char *CP);
+int GetCellWidth(const char *CP);
+const char *GetCellBytes(const char *CP, size_t *Size);
+void FreeClusters();
+
+typedef struct ClusterCase {
+	const char *String;
+	int Length;	/* What may be read, if less than all of it. */
+	int Size, Width;
+	int Interned;	/* Rather than kept in the cell, as a single character. */
+} ClusterCase;
+
+static const ClusterCase ClusterCases[] = {
+	{ "ax", 0, 1, 1, 0 },
+	{ "\xC3\xA9x", 0, 2, 1, 0 },	/* é, precomposed. */
+	{ "e\xCC\x81x", 0, 3, 1, 1 },	/* e & a combining acute. */
+	{ "e\xCC\x81\xCC\xA3x", 0, 5, 1, 1 },	/* Two marks. */
+	{ "e\xCC\x81x", 2, 1, 1, 0 },	/* Cut short. */
+	{ "\xE4\xB8\xAD\xCC\x81", 0, 5, 2, 1 },	/* Wide, with a mark. */
+	{ "\xE2\x9D\xA4\xEF\xB8\x8F", 0, 6, 2, 1 },	/* Heart & VS16. */
+	{ "\xF0\x9F\x91\x8D\xF0\x9F\x8F\xBD", 0, 8, 2, 1 },	/* Thumbs up & a skin tone. */
+	{ "\xF0\x9F\x87\xAF\xF0\x9F\x87\xB5\xF0\x9F\x87\xAF", 0, 8, 2, 1 },	/* A flag, then half of another. */
+	{ "\xF0\x9F\x91\xA8\xE2\x80\x8D\xF0\x9F\x91\xA9", 0, 11, 2, 1 },	/* ZWJ sequence. */
+	{ "a\xE2\x80\x8D" "b", 0, 4, 1, 1 }	/* Only non-ASCII follows a ZWJ. */
+};
+
+/* The handle should give back what was interned. */
+static int IsRoundTrip(const char *CP, const char *String, int Size)
+{
+	const char *Bytes;
+	size_t Length;
+
+	Bytes = GetCellBytes(CP, &Length);
+
+	return IsCluster(CP) && (int)Length == Size && !memcmp(Bytes, String, Size);
+}
+
+int main()
+{
+	const ClusterCase *C;
+	char CP[UTF8_MAX_BYTES], Again[UTF8_MAX_BYTES], Handles[MANY_CLUSTERS][UTF8_MAX_BYTES], String[16];
+	unsigned int N, Failures = 0;
+	size_t Length;
+	int Size, Width, I;
+
+	Unicode = 1;
+
+	for (N = 0; N < sizeof(ClusterCases) / sizeof(*ClusterCases); N++) {
+		C = &ClusterCases[N];
+
+		Size = GetClusterSize(C->String, C->Length ? (size_t)C->Length : strlen(C->String));
+		if (Size != C->Size) {
+			printf("cluster %u: %d bytes, expected %d\n", N, Size, C->Size);
+			Failures++;
+			continue;
+		}
+
+		Width = InternCluster(CP, C->String, Size);
+		if (Width != C->Width || GetCellWidth(CP) != Width) {
+			printf("cluster %u: %d columns, expected %d\n", N, Width, C->Width);
+			Failures++;
+			continue;
+		}
+
+		if (!C->Interned) {
+			if (IsCluster(CP) || memcmp(CP, C->String, Size)) {
+				printf("cluster %u: a single character wasn't kept as it is\n", N);
+				Failures++;
+			}
+			continue;
+		}
+
+		InternCluster(Again, C->String, Size);
+		if (!IsRoundTrip(CP, C->String, Size) || memcmp(CP, Again, UTF8_MAX_BYTES)) {
+			printf("cluster %u: the handle doesn't give it back once\n", N);
+			Failures++;
+		}
+	}
+
+	/* Without Unicode, each byte is a character. */
+	Unicode = 0;
+	if (GetClusterSize("e\xCC\x81", 3) != 1) {
+		printf("clusters are joined without unicode\n");
+		Failures++;
+	}
+	Unicode = 1;
+
+	/* Enough for the pool & its table to grow, each with its own handle. */
+	for (I = 0; I < MANY_CLUSTERS; I++) {
+		Size = sprintf(String, "%d\xCC\x81", I);
+		InternCluster(Handles[I], String, Size);
+		if (!IsRoundTrip(Handles[I], String, Size) || (I && !memcmp(Handles[I], Handles[I - 1], UTF8_MAX_BYTES)))
+			break;
+	}
+	for (N = 0; N < MANY_CLUSTERS && I == MANY_CLUSTERS; N++) {
+		Size = sprintf(String, "%u\xCC\x81", N);
+		InternCluster(Again, String, Size);
+		if (memcmp(Again, Handles[N], UTF8_MAX_BYTES))
+			I = N;
+	}
+	if (I != MANY_CLUSTERS) {
+		printf("cluster %d of many doesn't have a handle of its own\n", I);
+		Failures++;
+	}
+
+	/* Handles from before the pool was freed are shown as a space, & aren't given out again. */
+	FreeClusters();
+	if (IsCluster(Handles[0]) || GetCellWidth(Handles[0]) != 1 || GetCellBytes(Handles[0], &Length)[0] != ' ') {
+		printf("an old handle is still in use\n");
+		Failures++;
+	}
+
+	Size = sprintf(String, "0\xCC\x81");
+	InternCluster(CP, String, Size);
+	if (!IsRoundTrip(CP, String, Size) || !memcmp(CP, Handles[0], UTF8_MAX_BYTES)) {
+		printf("an old handle was given out again\n");
+		Failures++;
+	}
+	FreeClusters();
+
+	printf("%u failures\n", Failures);
+
+	return Failures != 0;
+}
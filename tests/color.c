@@ -0,0 +1,124 @@
+/*
+	Hexes Terminal Library
+	Checks colors are brought down to what terminals below truecolor can show, through the tables built at init.
+
+	Written by Richard Walmsley <richwalm@gmail.com>
+*/
+
+#include <stdio.h>
+
+#include "hexes.h"
+
+void BuildColorTables();
+unsigned int QuantizeColor(unsigned int Color, int Colors);
+
+typedef struct ColorCase {
+	unsigned int Color;
+	int Colors;
+	unsigned int Expected;
+} ColorCase;
+
+static const ColorCase ColorCases[] = {
+	/* Left alone at full depth, as are the basic colors at any. */
+	{ HEX_COL_TRUE(1, 2, 3), 0, HEX_COL_TRUE(1, 2, 3) },
+	{ HEX_COL_256(200), 0, HEX_COL_256(200) },
+	{ 0, 8, 0 },
+	{ 5, 8, 5 },
+	{ 16, 8, 16 },
+
+	/* The palette. */
+	{ HEX_COL_256(200), 256, HEX_COL_256(200) },
+	{ HEX_COL_256(5), 16, 6 },
+	{ HEX_COL_256(5), 8, 6 },
+	{ HEX_COL_256(12), 16, 13 },
+	{ HEX_COL_256(12), 8, 5 },
+	{ HEX_COL_256(196), 16, 10 },
+	{ HEX_COL_256(196), 8, 2 },
+	{ HEX_COL_256(231), 16, 16 },
+	{ HEX_COL_256(231), 8, 8 },
+
+	/* RGB. */
+	{ HEX_COL_TRUE(255, 0, 0), 256, HEX_COL_256(196) },
+	{ HEX_COL_TRUE(255, 0, 0), 16, 10 },
+	{ HEX_COL_TRUE(255, 0, 0), 8, 2 },
+	{ HEX_COL_TRUE(0, 0, 0), 256, HEX_COL_256(16) },
+	{ HEX_COL_TRUE(0, 0, 0), 16, 1 },
+	{ HEX_COL_TRUE(255, 255, 255), 256, HEX_COL_256(231) },
+	{ HEX_COL_TRUE(255, 255, 255), 16, 16 },
+	{ HEX_COL_TRUE(255, 255, 255), 8, 8 },
+	{ HEX_COL_TRUE(95, 135, 175), 256, HEX_COL_256(67) },
+	{ HEX_COL_TRUE(8, 8, 8), 256, HEX_COL_256(232) },
+	{ HEX_COL_TRUE(238, 238, 238), 256, HEX_COL_256(255) },
+	{ HEX_COL_TRUE(140, 140, 140), 256, HEX_COL_256(245) },
+	{ HEX_COL_TRUE(0, 200, 0), 16, 3 },
+	{ HEX_COL_TRUE(0, 250, 0), 16, 11 }
+};
+
+/* xterm's defaults, which the tables target. */
+static const unsigned char BasicPalette[16][3] = {
+	{ 0, 0, 0 }, { 205, 0, 0 }, { 0, 205, 0 }, { 205, 205, 0 },
+	{ 0, 0, 238 }, { 205, 0, 205 }, { 0, 205, 205 }, { 229, 229, 229 },
+	{ 127, 127, 127 }, { 255, 0, 0 }, { 0, 255, 0 }, { 255, 255, 0 },
+	{ 92, 92, 255 }, { 255, 0, 255 }, { 0, 255, 255 }, { 255, 255, 255 }
+};
+static const unsigned char CubeLevels[6] = { 0, 95, 135, 175, 215, 255 };
+
+int main()
+{
+	unsigned int N, Got, Failures = 0;
+	int R, G, B, I;
+
+	BuildColorTables();
+
+	for (N = 0; N < sizeof(ColorCases) / sizeof(*ColorCases); N++) {
+		Got = QuantizeColor(ColorCases[N].Color, ColorCases[N].Colors);
+		if (Got != ColorCases[N].Expected) {
+			printf("color %u: got %u, expected %u\n", N, Got, ColorCases[N].Expected);
+			Failures++;
+		}
+	}
+
+	/* What the terminal can show exactly should come back as itself. */
+	for (R = 0; R < 6; R++) {
+		for (G = 0; G < 6; G++) {
+			for (B = 0; B < 6; B++) {
+				Got = QuantizeColor(HEX_COL_TRUE(CubeLevels[R], CubeLevels[G], CubeLevels[B]), 256);
+				if (Got != HEX_COL_256(16 + R * 36 + G * 6 + B)) {
+					printf("cube %d, %d, %d: got %u\n", R, G, B, Got);
+					Failures++;
+				}
+			}
+		}
+	}
+
+	for (I = 0; I < 16; I++) {
+		Got = QuantizeColor(HEX_COL_TRUE(BasicPalette[I][0], BasicPalette[I][1], BasicPalette[I][2]), I < 8 ? 8 : 16);
+		if (Got != I + 1) {
+			printf("basic %d: got %u\n", I, Got);
+			Failures++;
+		}
+	}
+
+	/* Every RGB should land within the palette asked for. */
+	for (I = 0; I < 1 << 15; I++) {
+		R = (I >> 10) << 3; G = ((I >> 5) & 31) << 3; B = (I & 31) << 3;
+
+		Got = QuantizeColor(HEX_COL_TRUE(R, G, B), 256);
+		if (Got < HEX_COL_256(16) || Got >= HEX_COL_OFFSET_TRUE)
+			break;
+		Got = QuantizeColor(HEX_COL_TRUE(R, G, B), 16);
+		if (Got < 1 || Got > 16)
+			break;
+		Got = QuantizeColor(HEX_COL_TRUE(R, G, B), 8);
+		if (Got < 1 || Got > 8)
+			break;
+	}
+	if (I < 1 << 15) {
+		printf("%d, %d, %d: got %u, outside the palette\n", R, G, B, Got);
+		Failures++;
+	}
+
+	printf("%u failures\n", Failures);
+
+	return Failures != 0;
+}
@@ -0,0 +1,137 @@
+/*
+	Hexes Terminal Library
+	Checks each level of the cell comparison against the scalar one, over random spans & those around the block sizes.
+	Levels the CPU doesn't support are skipped.
+
+	Written by Richard Walmsley <richwalm@gmail.com>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hexes.h"
+
+#define	MAX_CELLS	160
+#define	TRIALS	20000
+
+extern char *Damage;
+
+void SelectCompareRoutines();
+unsigned int FindChange(const HexChar *A, const HexChar *B, unsigned int I, unsigned int End);
+unsigned int CountChanges(const HexChar *A, const HexChar *B, unsigned int Count);
+int IsSameSpan(const HexChar *A, const HexChar *B, unsigned int Count);
+
+static const char *Levels[] = { "scalar", "sse2", "avx2", "avx512" };
+#define	LEVEL_COUNT	(sizeof(Levels) / sizeof(*Levels))
+
+static const unsigned int EdgeLengths[] = { 0, 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 64, 65, 127, 128, 129 };
+#define	EDGE_COUNT	(sizeof(EdgeLengths) / sizeof(*EdgeLengths))
+
+typedef struct Results {
+	unsigned int Found, Changes;
+	int Same;
+	char Damage[MAX_CELLS];
+} Results;
+
+/* Cells are picked from a few, so many match. Bytes past the end of a character are sometimes left as junk, which
+   mustn't count. */
+static void RandomCell(HexChar *C)
+{
+	static const char *Chars[] = { "a", "b", " ", "\xc3\xa9" };
+	int Size;
+
+	memset(C, 0, sizeof(HexChar));
+	strcpy(C->CP, Chars[rand() % 4]);
+	Size = strlen(C->CP);
+	if (rand() % 4 == 0 && Size + 1 < UTF8_MAX_BYTES)
+		C->CP[Size + 1] = rand() % 255 + 1;
+
+	C->FG = rand() % 3;
+	C->BG = rand() % 3;
+	C->Attr = rand() % 8 == 0;
+
+	return;
+}
+
+static int SelectLevel(const char *Name)
+{
+	setenv("HEX_CPU", Name, 1);
+	SelectCompareRoutines();
+
+	return !strcmp(HexCPULevel(), Name);
+}
+
+static void Run(const HexChar *A, const HexChar *B, const char *Damaged, unsigned int I, unsigned int Count, Results *R)
+{
+	char Copy[MAX_CELLS];
+
+	memcpy(Copy, Damaged, MAX_CELLS);
+	Damage = Copy;
+	R->Found = FindChange(A, B, I, Count);
+	memcpy(R->Damage, Copy, MAX_CELLS);
+	Damage = NULL;
+
+	R->Changes = CountChanges(A, B, Count);
+	R->Same = IsSameSpan(A, B, Count);
+
+	return;
+}
+
+int main()
+{
+	HexChar A[MAX_CELLS], B[MAX_CELLS];
+	char Damaged[MAX_CELLS];
+	Results Scalar, Level;
+	unsigned int T, L, I, Count, Start, Failures = 0;
+	int Supported[LEVEL_COUNT];
+
+	for (L = 0; L < LEVEL_COUNT; L++) {
+		Supported[L] = SelectLevel(Levels[L]);
+		printf("%s: %s\n", Levels[L], Supported[L] ? "checking" : "skipped, not supported");
+	}
+
+	srand(1);
+	for (T = 0; T < TRIALS; T++) {
+		Count = T < EDGE_COUNT * 16 ? EdgeLengths[T % EDGE_COUNT] : rand() % (MAX_CELLS + 1);
+		Start = Count && rand() % 2 ? rand() % Count : 0;
+
+		for (I = 0; I < MAX_CELLS; I++) {
+			RandomCell(&A[I]);
+			if (rand() % 8)
+				B[I] = A[I];
+			else
+				RandomCell(&B[I]);
+
+			/* The same character, differing only past its end. */
+			if (rand() % 16 == 0 && strlen(B[I].CP) + 1 < UTF8_MAX_BYTES)
+				B[I].CP[strlen(B[I].CP) + 1] ^= 0x55;
+
+			Damaged[I] = rand() % 4 != 0;
+		}
+
+		SelectLevel(Levels[0]);
+		Run(A, B, Damaged, Start, Count, &Scalar);
+
+		for (L = 1; L < LEVEL_COUNT; L++) {
+			if (!Supported[L])
+				continue;
+
+			SelectLevel(Levels[L]);
+			Run(A, B, Damaged, Start, Count, &Level);
+
+			if (Level.Found != Scalar.Found || Level.Changes != Scalar.Changes || Level.Same != Scalar.Same ||
+				memcmp(Level.Damage, Scalar.Damage, MAX_CELLS)) {
+				if (Failures < 10)
+					printf("%s differs on trial %u (count %u, from %u): found %u/%u, changes %u/%u, same %d/%d\n",
+						Levels[L], T, Count, Start, Level.Found, Scalar.Found, Level.Changes, Scalar.Changes,
+						Level.Same, Scalar.Same);
+				Failures++;
+			}
+		}
+	}
+
+	printf("%u trials, %u failures\n", TRIALS, Failures);
+
+	return Failures != 0;
+}
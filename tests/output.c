@@ -0,0 +1,580 @@
+/*
+	Hexes Terminal Library
+	Checks what the flush sends for a few known cases, along with what it then takes the terminal to be showing.
+	The Unix sources are built in here, so their internals can be driven directly & the frame buffer read back.
+
+	Written by Richard Walmsley <richwalm@gmail.com>
+*/
+
+#include "../src/unix.c"
+#include "../src/unix_output.c"
+
+extern HexBuffer *Current, *Buffer, *Terminal;
+extern unsigned long *DamagedRows;
+extern char *TermDamage;
+extern unsigned long *TermRows;
+extern int *TermSpans;
+extern unsigned long long *TermHashes;
+
+void BuildColorTables();
+void SelectCompareRoutines();
+
+static unsigned int Failures;
+
+/* Starts the flush afresh, as HexInit() would leave it for a terminal with these quirks, with the cursor at home. */
+static void Setup(int W, int H, int NewQuirks, int NewMotion, int NewTabWidth, int NewColors)
+{
+	int Y;
+
+	HexFreeBuffer(Buffer);
+	HexFreeBuffer(Current);
+	free(Damage);
+	free(DamagedRows);
+	free(DamageSpans);
+	free(RowHashes);
+	FreeScrolling();
+	FreeDrawnRows();
+
+	Width = W;
+	Height = H;
+	Unicode = 1;
+	Quirks = NewQuirks;
+	Motion = NewMotion;
+	TabWidth = NewTabWidth;
+	HexColors = NewColors;
+	TerminalColors = GetTerminalColors();
+	Flags = 0;
+
+	Buffer = Terminal = HexNewBuffer(W, H);
+	Current = HexNewBuffer(W, H);
+	Damage = TermDamage = calloc(W * H, 1);
+	DamagedRows = TermRows = calloc(H, sizeof(unsigned long));
+	DamageSpans = TermSpans = malloc(H * 2 * sizeof(int));
+	RowHashes = TermHashes = malloc(H * sizeof(unsigned long long));
+	if (!(Buffer && Current && Damage && DamagedRows && DamageSpans && RowHashes)) {
+		printf("out of memory\n");
+		exit(1);
+	}
+	HasDamage = 0;
+	for (Y = 0; Y < H; Y++)
+		RowHashes[Y] = GetRowHash(&Buffer->Data[Y * W]);
+
+	ExtendOutputBuffer();
+	BuildColorTables();
+	BuildSGRTables();
+	BuildMoveTables();
+	SelectDrawRoutines();
+
+	memset(Term, 0, sizeof(TermState));
+	OutputUsed = 0;
+
+	return;
+}
+
+/* What's been collected since the last call. */
+static const char *TakeOutput()
+{
+	static char Taken[1024];
+	size_t Size = OutputUsed < sizeof(Taken) - 1 ? OutputUsed : sizeof(Taken) - 1;
+
+	memcpy(Taken, OutputBuffer, Size);
+	Taken[Size] = '\0';
+	OutputUsed = 0;
+
+	return Taken;
+}
+
+/* Escapes are shown as \e, with other controls in hex. */
+static void PrintEscaped(const char *S)
+{
+	for (; *S; S++) {
+		if (*S == '\x1B')
+			printf("\\e");
+		else if ((unsigned char)*S < ' ')
+			printf("\\x%02X", *S);
+		else
+			putchar(*S);
+	}
+
+	return;
+}
+
+static void Fail(const char *Table, int N, const char *Got, const char *Expected)
+{
+	printf("%s %d: got \"", Table, N);
+	PrintEscaped(Got);
+	printf("\", expected \"");
+	PrintEscaped(Expected);
+	printf("\"\n");
+	Failures++;
+
+	return;
+}
+
+/* SGR changes. The shorter of the incremental change & a reset should be picked, with the terminal's colors applied. */
+typedef struct StyleCase {
+	unsigned int FG, BG, Attr;	/* From. */
+	unsigned int ToFG, ToBG, ToAttr;
+	int Quirks, Colors;
+	const char *Expected;
+	unsigned int Attributes;	/* What the terminal's left in, which may gain bold. */
+} StyleCase;
+
+static const StyleCase StyleCases[] = {
+	{ 0, 0, 0, 0, 0, 0, 0, 0, "", 0 },
+	{ 0, 0, 0, 2, 0, 0, 0, 0, ESC "[31m", 0 },
+	{ 2, 0, HEX_ATTR_BOLD, 2, 0, 0, 0, 0, ESC "[22m", 0 },
+	{ 2, 3, HEX_ATTR_BOLD | HEX_ATTR_ITALIC | HEX_ATTR_UNDERLINE, 0, 0, 0, 0, 0, ESC "[0m", 0 },
+	{ 2, 3, 0, 0, 3, 0, 0, 0, ESC "[39m", 0 },
+	{ 2, 3, HEX_ATTR_BOLD, 2, 3, HEX_ATTR_FAINT, 0, 0, ESC "[22;2m", HEX_ATTR_FAINT },
+	{ 0, 0, HEX_ATTR_BOLD | HEX_ATTR_FAINT, 0, 0, HEX_ATTR_BOLD, 0, 0, ESC "[0;1m", HEX_ATTR_BOLD },
+	{ 0, 0, 0, 10, 0, 0, 0, 0, ESC "[31;1m", HEX_ATTR_BOLD },
+	{ 0, 0, 0, HEX_COL_256(200), 0, 0, 0, 0, ESC "[38;5;200m", 0 },
+	{ 0, 0, 0, 0, HEX_COL_TRUE(1, 2, 3), 0, 0, 0, ESC "[48;2;1;2;3m", 0 },
+	{ 2, 3, 0, 0, 0, 0, QUIRK_NO_DEFAULT_COLORS_CODES, 0, ESC "[37;40m", 0 },
+	{ 2, 3, HEX_ATTR_UNDERLINE, 0, 0, 0, QUIRK_NO_DEFAULT_COLORS_CODES, 0, ESC "[0;37;40m", 0 },
+	{ 0, 0, 0, HEX_COL_TRUE(255, 0, 0), 0, 0, 0, HEX_COL_OFFSET_256 + 16, ESC "[31;1m", HEX_ATTR_BOLD },
+	{ 0, 0, 0, HEX_COL_TRUE(255, 0, 0), 0, 0, 0, HEX_COL_OFFSET_TRUE - 1, ESC "[38;5;196m", 0 }
+};
+
+static void CheckStyles()
+{
+	const StyleCase *C;
+	const char *Got;
+	unsigned int N;
+
+	for (N = 0; N < sizeof(StyleCases) / sizeof(*StyleCases); N++) {
+		C = &StyleCases[N];
+		Setup(8, 2, C->Quirks, 0, 0, C->Colors);
+		Term->FG = C->FG; Term->BG = C->BG; Term->Attr = C->Attr;
+
+		ChangeCursor(C->ToFG, C->ToBG, C->ToAttr);
+		Got = TakeOutput();
+		if (strcmp(Got, C->Expected))
+			Fail("style", N, Got, C->Expected);
+		else if (*C->Expected && (Term->FG != C->ToFG || Term->BG != C->ToBG || Term->Attr != C->Attributes)) {
+			printf("style %d: left in %u, %u, %u\n", N, Term->FG, Term->BG, Term->Attr);
+			Failures++;
+		}
+	}
+
+	return;
+}
+
+/* Cursor motion. The cheapest of what the terminal allows should be sent, leaving the cursor where it was asked. */
+typedef struct MoveCase {
+	int Quirks, Motion, TabWidth;
+	int X, Y, OnRightEdge;	/* From, with a negative Y if it's not known. */
+	int ToX, ToY;
+	const char *Expected;
+} MoveCase;
+
+static const MoveCase MoveCases[] = {
+	{ 0, 0, 0, 3, 2, 0, 3, 2, "" },
+	{ 0, 0, 0, 3, -1, 0, 4, 2, ESC "[3;5H" },
+	{ 0, 0, 0, 0, 0, 0, 0, 3, ESC "[4H" },
+	{ 0, 0, 0, 5, 3, 0, 5, 4, ESC "[B" },
+	{ 0, MOTION_LF, 0, 5, 3, 0, 5, 4, "\n" },
+	{ 0, MOTION_LF | MOTION_CR, 0, 5, 3, 0, 0, 4, "\n\r" },
+	{ 0, MOTION_LF | MOTION_LF_RETURNS, 0, 5, 3, 0, 0, 5, "\n\n" },
+	{ 0, 0, 8, 0, 1, 0, 16, 1, "\t\t" },
+	{ 0, 0, 8, 3, 1, 0, 24, 1, "\t\t\t" },
+	{ 0, MOTION_CR, 8, 30, 1, 0, 16, 1, "\r\t\t" },
+	{ QUIRK_ABS_COL_CODE, 0, 0, 30, 2, 0, 2, 2, ESC "[3G" },
+	{ 0, 0, 0, 5, 2, 0, 3, 2, "\b\b" },
+	{ 0, 0, 0, 39, 2, 1, 37, 2, ESC "[2D" },
+	{ 0, MOTION_LF, 0, 39, 2, 1, 39, 3, ESC "[B" },
+	{ QUIRK_WRAPPING_FIX, 0, 0, 39, 2, 1, 39, 3, ESC "[4;40H" },
+	{ QUIRK_LINE_CODES, 0, 0, 20, 5, 0, 0, 4, ESC "[F" }
+};
+
+static void CheckMoves()
+{
+	const MoveCase *C;
+	const char *Got;
+	unsigned int N;
+
+	for (N = 0; N < sizeof(MoveCases) / sizeof(*MoveCases); N++) {
+		C = &MoveCases[N];
+		Setup(40, 10, C->Quirks, C->Motion, C->TabWidth, 0);
+		Term->X = C->X; Term->Y = C->Y; Term->OnRightEdge = C->OnRightEdge;
+
+		MoveCursor(C->ToX, C->ToY);
+		Got = TakeOutput();
+		if (strcmp(Got, C->Expected))
+			Fail("move", N, Got, C->Expected);
+		else if (Term->X != C->ToX || Term->Y != C->ToY || Term->OnRightEdge) {
+			printf("move %d: left at %d, %d\n", N, Term->X, Term->Y);
+			Failures++;
+		}
+	}
+
+	return;
+}
+
+/* Rows for the cases below. Each character is a cell, with '.' left as the default. */
+static void SetRow(HexChar *Row, const char *Cells, unsigned int BG, unsigned int Attr)
+{
+	int X;
+
+	for (X = 0; X < Width && Cells[X]; X++) {
+		if (Cells[X] == '.')
+			continue;
+
+		memset(&Row[X], 0, sizeof(HexChar));
+		Row[X].CP[0] = Cells[X];
+		Row[X].BG = BG;
+		Row[X].Attr = Attr;
+	}
+
+	return;
+}
+
+/* Runs of identical cells. REP, ECH & EL should only be used when shorter, with Current taking what was covered. */
+typedef struct RunCase {
+	int Quirks;
+	const char *Current, *Buffer;
+	unsigned int BG, Attr, TermBG;
+	unsigned int I;
+	const char *Expected;
+	unsigned int Covered, Cursor;
+} RunCase;
+
+static const RunCase RunCases[] = {
+	{ 0, "", "aaaaa", 0, 0, 0, 0, "aaaaa", 5, 5 },
+	{ QUIRK_REP_CODE, "", "aaaaa", 0, 0, 0, 0, "aaaaa", 5, 5 },
+	{ QUIRK_REP_CODE, "", "aaaaaa", 0, 0, 0, 0, "a" ESC "[5b", 6, 6 },
+	{ QUIRK_REP_CODE, "...aaa", "aaaaaa", 0, 0, 0, 0, "aaa", 3, 3 },
+	{ QUIRK_ECH_CODE, "", "          x", 0, 0, 0, 0, "          ", 10, 10 },
+	{ QUIRK_ECH_CODE, "", "            x", 0, 0, 0, 0, ESC "[12X", 12, 0 },
+	{ QUIRK_REP_CODE | QUIRK_ECH_CODE, "", "            x", 0, 0, 0, 0, " " ESC "[11b", 12, 12 },
+	{ 0, "", "....                ", 0, 0, 0, 4, ESC "[K", 16, 4 },
+	{ 0, "", "....    ", 0, 0, 0, 4, ESC "[K", 16, 4 },
+	{ 0, "", "....    ", 0, HEX_ATTR_UNDERLINE, 0, 4, "    ", 4, 8 },
+	{ 0, "", "................    ", 2, 0, 0, 16, "    ", 4, 20 },
+	{ 0, "", "................    ", 2, 0, 2, 16, "    ", 4, 20 },
+	{ QUIRK_BACK_COLOR_ERASE, "", "................    ", 2, 0, 2, 16, ESC "[K", 4, 16 }
+};
+
+static void CheckRuns()
+{
+	const RunCase *C;
+	const char *Got;
+	unsigned int N, I, Covered, Cursor;
+
+	for (N = 0; N < sizeof(RunCases) / sizeof(*RunCases); N++) {
+		C = &RunCases[N];
+		Setup(20, 2, C->Quirks, 0, 0, 0);
+		SetRow(Current->Data, C->Current, 0, 0);
+		SetRow(Buffer->Data, C->Buffer, C->BG, C->Attr);
+		memset(Damage, 1, Width);
+		Term->X = C->I; Term->BG = C->TermBG;
+
+		Covered = OutputRun(Buffer->Data, C->I, 0, &Cursor);
+		Got = TakeOutput();
+		if (strcmp(Got, C->Expected)) {
+			Fail("run", N, Got, C->Expected);
+			continue;
+		}
+		if (Covered != C->Covered || Cursor != C->Cursor) {
+			printf("run %d: covered %u with the cursor at %u\n", N, Covered, Cursor);
+			Failures++;
+			continue;
+		}
+
+		for (I = C->I; I < C->I + Covered; I++) {
+			if (!IsSameChar(&Current->Data[I], &Buffer->Data[I]) || Damage[I]) {
+				printf("run %d: cell %u wasn't taken\n", N, I);
+				Failures++;
+				break;
+			}
+		}
+	}
+
+	return;
+}
+
+/* Screens for the scrolling cases. Each character is a row, with a digit giving the one of the starting screen it holds
+   & '_' for a blank. Rows are filled with a letter of their own, so each is unique. */
+static void SetRows(HexChar *Data, const char *Rows, const HexChar *Blank)
+{
+	int X, Y;
+
+	for (Y = 0; Y < Height; Y++) {
+		for (X = 0; X < Width; X++) {
+			HexChar *C = &Data[Y * Width + X];
+
+			if (Rows[Y] == '_')
+				*C = *Blank;
+			else {
+				memset(C, 0, sizeof(HexChar));
+				C->CP[0] = 'A' + Rows[Y] - '0';
+			}
+		}
+	}
+
+	return;
+}
+
+/* Scrolling. Moved rows should be found & scrolled into place, in a region when not the whole screen, with the blanks
+   in the right color. Current should then hold the rows where they were moved to. */
+typedef struct ScrollCase {
+	int Quirks;
+	unsigned int TermBG;
+	const char *Buffer;
+	const char *Expected;
+	const char *Current;
+} ScrollCase;
+
+#define	SCROLL_SU	(QUIRK_SCROLL_REGION | QUIRK_SCROLL_CODES)
+#define	SCROLL_IL	(QUIRK_SCROLL_REGION | QUIRK_INSERT_LINE_CODES)
+
+static const ScrollCase ScrollCases[] = {
+	{ SCROLL_SU, 0, "12345_", ESC "[S", "12345_" },
+	{ SCROLL_SU, 0, "2345__", ESC "[2S", "2345__" },
+	{ SCROLL_SU, 0, "_01234", ESC "[T", "_01234" },
+	{ SCROLL_IL, 0, "12345_", ESC "[M", "12345_" },
+	{ SCROLL_IL, 0, "_01234", ESC "[L", "_01234" },
+	{ SCROLL_SU, 0, "0234_5", ESC "[2;5r" ESC "[S" ESC "[r", "0234_5" },
+	{ SCROLL_IL, 0, "0234_5", ESC "[2;5r" ESC "[B" ESC "[M" ESC "[r", "0234_5" },
+	{ SCROLL_SU, 2, "12345_", ESC "[0m" ESC "[S", "12345_" },
+	{ SCROLL_SU | QUIRK_BACK_COLOR_ERASE, 2, "12345_", ESC "[S", "12345_" },
+	{ SCROLL_SU | QUIRK_NO_DEFAULT_COLORS_CODES, 0, "12345_", "", "012345" },
+	{ QUIRK_SCROLL_CODES, 0, "12345_", "", "012345" }
+};
+
+static void CheckScrolling()
+{
+	const ScrollCase *C;
+	const char *Got;
+	HexChar Blank, Expected[6 * 10];
+	unsigned int N;
+	int Y;
+
+	for (N = 0; N < sizeof(ScrollCases) / sizeof(*ScrollCases); N++) {
+		C = &ScrollCases[N];
+		Setup(10, 6, C->Quirks, 0, 0, 0);
+		memset(&Blank, 0, sizeof(Blank));
+		SetRows(Current->Data, "012345", &Blank);
+		SetRows(Buffer->Data, C->Buffer, &Blank);
+		for (Y = 0; Y < Height; Y++)
+			RowHashes[Y] = GetRowHash(&Buffer->Data[Y * Width]);
+		SetDamage(0, 0, Width, Height);
+		Term->BG = C->TermBG;
+
+		ScrollPass();
+		Got = TakeOutput();
+		if (strcmp(Got, C->Expected)) {
+			Fail("scroll", N, Got, C->Expected);
+			continue;
+		}
+
+		Blank = GetBlankChar();
+		SetRows(Expected, C->Current, &Blank);
+		if (!IsSameSpan(Current->Data, Expected, Width * Height)) {
+			printf("scroll %d: rows weren't moved\n", N);
+			Failures++;
+		}
+	}
+
+	return;
+}
+
+/* Shifting. Characters inserted or deleted within a row should be made with ICH or DCH when that's cheaper than redrawing
+   the rest of it, with Current shifted to match. */
+typedef struct ShiftCase {
+	int Quirks;
+	unsigned int TermBG;
+	const char *Current, *Buffer;
+	const char *Expected;
+	const char *Shifted;
+} ShiftCase;
+
+#define	SHIFT_BOTH	(QUIRK_INSERT_CHAR_CODE | QUIRK_DELETE_CHAR_CODE)
+
+static const ShiftCase ShiftCases[] = {
+	{ SHIFT_BOTH, 0, "abcdefghijklmnop", "abcXdefghijklmnop", ESC "[3C" ESC "[@", "abc.defghijklmnop" },
+	{ SHIFT_BOTH, 0, "abcdefghijklmnop", "abcXYZdefghijklmnop", ESC "[3C" ESC "[3@", "abc...defghijklmnop" },
+	{ SHIFT_BOTH, 0, "abcdefghijklmnop", "abcefghijklmnop", ESC "[3C" ESC "[P", "abcefghijklmnop...." },
+	{ SHIFT_BOTH, 0, "abcdefghijklmnop", "abefghijklmnop", ESC "[2C" ESC "[2P", "abefghijklmnop......" },
+	{ QUIRK_DELETE_CHAR_CODE, 0, "abcdefghijklmnop", "abcXdefghijklmnop", "", "abcdefghijklmnop" },
+	{ SHIFT_BOTH, 0, "abcdef", "abcXdef", "", "abcdef" },
+	{ SHIFT_BOTH, 2, "abcdefghijklmnop", "abcXdefghijklmnop", ESC "[0m" ESC "[3C" ESC "[@", "abc.defghijklmnop" },
+	{ SHIFT_BOTH | QUIRK_NO_DEFAULT_COLORS_CODES, 0, "abcdefghijklmnop", "abcXdefghijklmnop", "", "abcdefghijklmnop" }
+};
+
+static void CheckShifting()
+{
+	const ShiftCase *C;
+	const char *Got;
+	HexChar Expected[20];
+	unsigned int N;
+
+	for (N = 0; N < sizeof(ShiftCases) / sizeof(*ShiftCases); N++) {
+		C = &ShiftCases[N];
+		Setup(20, 1, C->Quirks, 0, 0, 0);
+		SetRow(Current->Data, C->Current, 0, 0);
+		SetRow(Buffer->Data, C->Buffer, 0, 0);
+		SetDamage(0, 0, Width, 1);
+		Term->BG = C->TermBG;
+
+		ShiftPass();
+		Got = TakeOutput();
+		if (strcmp(Got, C->Expected)) {
+			Fail("shift", N, Got, C->Expected);
+			continue;
+		}
+
+		memset(Expected, 0, sizeof(Expected));
+		SetRow(Expected, C->Shifted, 0, 0);
+		if (!IsSameSpan(Current->Data, Expected, Width)) {
+			printf("shift %d: the row wasn't shifted\n", N);
+			Failures++;
+		}
+	}
+
+	return;
+}
+
+/* Flushes as the app would, with what's written to stdout caught rather than sent. Returns what the flush did. */
+static int CaptureFlush(size_t Budget, size_t *Sent)
+{
+	char Discard[4096];
+	ssize_t Size;
+	int Pipe[2], Saved, Return;
+
+	fflush(stdout);
+	Saved = dup(STDOUT_FILENO);
+	if (Saved == -1 || pipe(Pipe) == -1) {
+		printf("can't capture the output\n");
+		exit(1);
+	}
+	dup2(Pipe[1], STDOUT_FILENO);
+	close(Pipe[1]);
+
+	Return = HexFlushBudget(Budget, -1, -1);
+
+	dup2(Saved, STDOUT_FILENO);
+	close(Saved);
+
+	*Sent = 0;
+	while ((Size = read(Pipe[0], Discard, sizeof(Discard))) > 0)
+		*Sent += Size;
+	close(Pipe[0]);
+
+	return Return;
+}
+
+/* Whether each cell still to be drawn has kept its damage. */
+static int IsDamageKept()
+{
+	int I;
+
+	for (I = 0; I < Width * Height; I++) {
+		if (!IsSameChar(&Current->Data[I], &Buffer->Data[I]) && (!Damage[I] || !IsRowDamaged(I / Width)))
+			return 0;
+	}
+
+	return HasDamage;
+}
+
+/* Nothing outside the priority row should be drawn before all of it has been. */
+static int IsPriorityFirst(int Row)
+{
+	int I;
+
+	if (Row < 0 || IsSameSpan(&Current->Data[Row * Width], &Buffer->Data[Row * Width], Width))
+		return 1;
+
+	for (I = 0; I < Width * Height; I++) {
+		if (I / Width != Row && IsSameChar(&Current->Data[I], &Buffer->Data[I]))
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Budgeted flushes. Each should stop once about the budget's been sent, keeping the damage that's left for the next,
+   with the priority area drawn first. */
+typedef struct BudgetCase {
+	size_t Budget;
+	int Priority;	/* The row that's given priority, if any. */
+	int Flushes;	/* Needed to draw everything. */
+} BudgetCase;
+
+#define	MAX_CELL_COST	16	/* A move & a cell, which may be sent once the budget's been reached. */
+
+static const BudgetCase BudgetCases[] = {
+	{ 0, -1, 1 },
+	{ 1000, -1, 1 },
+	{ 30, -1, 3 },
+	{ 30, 3, 3 },
+	{ 1, 2, 80 }
+};
+
+static void CheckBudgets()
+{
+	const BudgetCase *C;
+	size_t Sent;
+	unsigned int N;
+	int I, Flushes, Done;
+
+	for (N = 0; N < sizeof(BudgetCases) / sizeof(*BudgetCases); N++) {
+		C = &BudgetCases[N];
+		Setup(20, 4, 0, 0, 0, 0);
+		for (I = 0; I < Width * Height; I++)
+			Buffer->Data[I].CP[0] = 'a' + I % 26;
+		for (I = 0; I < Height; I++)
+			RowHashes[I] = GetRowHash(&Buffer->Data[I * Width]);
+		SetDamage(0, 0, Width, Height);
+		HexClearPriorities();
+		if (C->Priority >= 0)
+			HexAddPriority(0, C->Priority, Width, 1);
+
+		for (Flushes = 1, Done = 0; Flushes <= Width * Height && !Done; Flushes++) {
+			Done = CaptureFlush(C->Budget, &Sent);
+
+			if (C->Budget && Sent >= C->Budget + MAX_CELL_COST) {
+				printf("budget %d: sent %lu on flush %d\n", N, (unsigned long)Sent, Flushes);
+				Failures++;
+				break;
+			}
+			if (!Done && !IsDamageKept()) {
+				printf("budget %d: damage was lost on flush %d\n", N, Flushes);
+				Failures++;
+				break;
+			}
+			if (!IsPriorityFirst(C->Priority)) {
+				printf("budget %d: the priority wasn't drawn first\n", N);
+				Failures++;
+				break;
+			}
+		}
+		Flushes--;
+
+		if (!Done || Flushes != C->Flushes || HasDamage || !IsSameSpan(Current->Data, Buffer->Data, Width * Height)) {
+			printf("budget %d: %s after %d flushes, expected %d\n", N, Done ? "done" : "not done", Flushes, C->Flushes);
+			Failures++;
+		}
+	}
+
+	HexClearPriorities();
+
+	return;
+}
+
+int main()
+{
+	SelectCompareRoutines();
+
+	CheckStyles();
+	CheckMoves();
+	CheckRuns();
+	CheckScrolling();
+	CheckShifting();
+	CheckBudgets();
+
+	printf("%u failures\n", Failures);
+
+	return Failures != 0;
+}
@@ -0,0 +1,111 @@
+#!/usr/bin/env python3
+#
+# Hexes Terminal Library
+# Generates src/unicode_tables.h, the character width tables, from the Unicode character database.
+#
+# Usage: gen_width.py EastAsianWidth.txt DerivedGeneralCategory.txt unicode_tables.h
+#
+# The files are found under https://www.unicode.org/Public/<version>/ucd/, with DerivedGeneralCategory.txt being in the
+# extracted/ directory. Both need to be from the same version.
+#
+# Written by Richard Walmsley <richwalm@gmail.com>
+
+import os
+import re
+import sys
+
+# Hangul medial vowels & final consonants, which join onto the syllable before.
+JOINING_JAMO = (0x1160, 0x11FF)
+
+# Format characters which are shown, rather than taking no space.
+SHOWN_FORMAT = {0x00AD}
+
+PER_LINE = 5
+
+
+def read_property(path):
+    """Gives the version of the file, along with a list of (first, last, value) for each of its entries."""
+    entries, version = [], None
+
+    with open(path, encoding='utf-8') as f:
+        for line in f:
+            if version is None:
+                match = re.match(r'#\s*\S+-(\d+\.\d+\.\d+)\.txt', line)
+                if match:
+                    version = match.group(1)
+
+            line = line.split('#', 1)[0].strip()
+            if not line:
+                continue
+
+            codes, value = (field.strip() for field in line.split(';')[:2])
+            first, _, last = codes.partition('..')
+            entries.append((int(first, 16), int(last or first, 16), value))
+
+    return version, entries
+
+
+def merge(code_points):
+    """Sorted code points into (first, last) ranges."""
+    ranges = []
+
+    for cp in sorted(code_points):
+        if ranges and ranges[-1][1] == cp - 1:
+            ranges[-1][1] = cp
+        else:
+            ranges.append([cp, cp])
+
+    return ranges
+
+
+def format_table(name, comment, ranges):
+    cells = ['{ 0x%04X, 0x%04X }' % (first, last) for first, last in ranges]
+    lines = [', '.join(cells[i:i + PER_LINE]) for i in range(0, len(cells), PER_LINE)]
+
+    return '/* %s */\nstatic const CodePointRange %s[] = {\n\t%s\n};\n' % (comment, name, ',\n\t'.join(lines))
+
+
+def main():
+    if len(sys.argv) != 4:
+        sys.exit('Usage: %s EastAsianWidth.txt DerivedGeneralCategory.txt unicode_tables.h' % sys.argv[0])
+
+    width_version, widths = read_property(sys.argv[1])
+    category_version, categories = read_property(sys.argv[2])
+    if width_version != category_version:
+        sys.exit('The files are from different versions, %s & %s.' % (width_version, category_version))
+
+    # Unassigned code points only appear in the widths where their block reserves them as wide.
+    wide = set()
+    for first, last, value in widths:
+        if value in ('W', 'F'):
+            wide.update(range(first, last + 1))
+
+    zero = set(range(JOINING_JAMO[0], JOINING_JAMO[1] + 1))
+    for first, last, value in categories:
+        if value in ('Mn', 'Me', 'Cf'):
+            zero.update(range(first, last + 1))
+    zero -= SHOWN_FORMAT
+
+    output = ('/*\n'
+        '\tHexes Terminal Library\n'
+        '\tCharacter width tables. Generated by tools/gen_width.py from the Unicode %s character database, using\n'
+        '\tEastAsianWidth.txt & DerivedGeneralCategory.txt. Run \'make unicode-tables\' to regenerate, rather than editing.\n'
+        '\n'
+        '\tWritten by Richard Walmsley <richwalm@gmail.com>\n'
+        '*/\n\n' % width_version)
+    output += format_table('WideRanges', 'East Asian Wide & Fullwidth. Unassigned code points are left out, except in the '
+        'blocks where '
+        'they\'re reserved as wide.', merge(wide))
+    output += '\n'
+    output += format_table('ZeroWidthRanges', 'Nonspacing & enclosing marks, format characters & the Hangul medial vowels '
+        '& final consonants.', merge(zero))
+
+    # Only replaced once it's all been worked out.
+    temp = sys.argv[3] + '.tmp'
+    with open(temp, 'w', encoding='utf-8') as f:
+        f.write(output)
+    os.replace(temp, sys.argv[3])
+
+
+if __name__ == '__main__':
+    main()